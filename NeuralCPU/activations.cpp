@@ -0,0 +1,223 @@
+#include "activations.h"
+#include "matrixSimd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define SIMD_TARGET(x)
+#else
+#define SIMD_TARGET(x) __attribute__((target(x)))
+#endif
+
+// exp(x) = 2^n * 2^f with n = round(x*log2(e)) and f in [-0.5, 0.5], where
+// 2^f comes from a near-minimax polynomial.  Max. relative errors are about
+// 1.8e-3, 7.7e-5 and 7.6e-8 for the three tiers.  tanh and sigmoid are then
+// built from exp, which halves the absolute error for tanh.
+struct Exp2Poly
+{
+  int   degree;
+  float coeffs[6];
+};
+
+static const Exp2Poly s_polys[] =
+{
+  { 2, { 1.00043914f, 0.703353662f, 0.238382251f } },
+  { 3, { 0.999928968f, 0.693260706f, 0.242598056f, 0.0551665087f } },
+  { 5, { 1.00000007f, 0.693146968f, 0.240221229f, 0.0555071318f, 0.00967537917f, 0.00132760375f } },
+};
+
+static const float s_log2e  = 1.44269504f;
+static const float s_maxExp = 126.0f;  // Keeps 2^n a normal float
+
+static const Exp2Poly& PolyFor(ActivationAccuracy a_accuracy)
+{
+  switch (a_accuracy)
+  {
+  case ActivationAccuracy::Fast:   return s_polys[0];
+  case ActivationAccuracy::Tol1e4: return s_polys[1];
+  default:                         return s_polys[2];
+  }
+}
+
+static float FastExp(float a_x, const Exp2Poly& a_poly)
+{
+  float t = a_x * s_log2e;
+  t = t < -s_maxExp ? -s_maxExp : (t > s_maxExp ? s_maxExp : t);
+  float n = floorf(t + 0.5f);
+  float f = t - n;
+
+  float p = a_poly.coeffs[a_poly.degree];
+  for (int i = a_poly.degree - 1; i >= 0; i--)
+    p = p * f + a_poly.coeffs[i];
+
+  int32_t bits = ((int32_t)n + 127) << 23;
+  float scale;
+  memcpy(&scale, &bits, sizeof(scale));
+  return p * scale;
+}
+
+SIMD_TARGET("avx2,fma")
+static __m256 FastExpAvx2(__m256 a_x, const Exp2Poly& a_poly)
+{
+  __m256 t = _mm256_mul_ps(a_x, _mm256_set1_ps(s_log2e));
+  t = _mm256_max_ps(_mm256_min_ps(t, _mm256_set1_ps(s_maxExp)), _mm256_set1_ps(-s_maxExp));
+  __m256 n = _mm256_round_ps(t, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256 f = _mm256_sub_ps(t, n);
+
+  __m256 p = _mm256_set1_ps(a_poly.coeffs[a_poly.degree]);
+  for (int i = a_poly.degree - 1; i >= 0; i--)
+    p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(a_poly.coeffs[i]));
+
+  __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+}
+
+// tanh(x) = 1 - 2 / (exp(2x) + 1)
+SIMD_TARGET("avx2,fma")
+static int TanhAvx2(float* a_data, int a_count, const Exp2Poly& a_poly)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  int i = 0;
+  for (; i + 8 <= a_count; i += 8)
+  {
+    __m256 e = FastExpAvx2(_mm256_mul_ps(_mm256_loadu_ps(a_data + i), two), a_poly);
+    _mm256_storeu_ps(a_data + i, _mm256_sub_ps(one, _mm256_div_ps(two, _mm256_add_ps(e, one))));
+  }
+  // Run the tail through a padded vector too, so results don't depend on
+  // where an element sits in the array
+  if (i < a_count)
+  {
+    float tail[8] = {};
+    std::copy(a_data + i, a_data + a_count, tail);
+    __m256 e = FastExpAvx2(_mm256_mul_ps(_mm256_loadu_ps(tail), two), a_poly);
+    _mm256_storeu_ps(tail, _mm256_sub_ps(one, _mm256_div_ps(two, _mm256_add_ps(e, one))));
+    std::copy(tail, tail + (a_count - i), a_data + i);
+  }
+  return a_count;
+}
+
+// sigmoid(x) = 1 / (1 + exp(-x))
+SIMD_TARGET("avx2,fma")
+static int SigmoidAvx2(float* a_data, int a_count, const Exp2Poly& a_poly)
+{
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 zero = _mm256_setzero_ps();
+  int i = 0;
+  for (; i + 8 <= a_count; i += 8)
+  {
+    __m256 e = FastExpAvx2(_mm256_sub_ps(zero, _mm256_loadu_ps(a_data + i)), a_poly);
+    _mm256_storeu_ps(a_data + i, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+  }
+  // Padded tail, as in TanhAvx2
+  if (i < a_count)
+  {
+    float tail[8] = {};
+    std::copy(a_data + i, a_data + a_count, tail);
+    __m256 e = FastExpAvx2(_mm256_sub_ps(zero, _mm256_loadu_ps(tail)), a_poly);
+    _mm256_storeu_ps(tail, _mm256_div_ps(one, _mm256_add_ps(one, e)));
+    std::copy(tail, tail + (a_count - i), a_data + i);
+  }
+  return a_count;
+}
+
+// tanh sampled at s_tableSize+1 points over [-s_tableRange, s_tableRange],
+// plus one guard sample at each end for the cubic stencil.  tanh(8) is within
+// 2.3e-7 of 1, so clamping outside the range costs nothing at float precision.
+static const int   s_tableSize  = 512;
+static const float s_tableRange = 8.0f;
+static const float s_tableStep  = 2.0f * s_tableRange / s_tableSize;
+
+static const float* TanhTable()
+{
+  static float s_table[s_tableSize + 3];
+  static bool s_built = []()
+  {
+    for (int i = 0; i < s_tableSize + 3; i++)
+      s_table[i] = (float)tanh(-s_tableRange + (i - 1) * (double)s_tableStep);
+    return true;
+  }();
+  (void)s_built;
+  return s_table;
+}
+
+static float TableTanh(const float* a_table, float a_x, bool a_cubic)
+{
+  float t = (a_x + s_tableRange) * (1.0f / s_tableStep);
+  if (!(t > 0.0f))  // Also catches NaN
+    return -1.0f;
+  if (t >= (float)s_tableSize)
+    return 1.0f;
+
+  int i = (int)t;
+  float f = t - i;
+  const float* p = a_table + i;  // p[1] is the sample at or below a_x
+  if (!a_cubic)
+    return p[1] + f * (p[2] - p[1]);
+
+  // Catmull-Rom through p[0..3]
+  return p[1] + 0.5f * f * (p[2] - p[0] + f * (2.0f*p[0] - 5.0f*p[1] + 4.0f*p[2] - p[3] + f * (3.0f*(p[1] - p[2]) + p[3] - p[0])));
+}
+
+float ActivationErrorBound(ActivationAccuracy a_accuracy)
+{
+  switch (a_accuracy)
+  {
+  case ActivationAccuracy::Fast:        return 1e-3f;
+  case ActivationAccuracy::Tol1e4:      return 1e-4f;
+  case ActivationAccuracy::TableLinear: return 1e-4f;
+  case ActivationAccuracy::TableCubic:  return 1e-5f;
+  default:                              return 1e-6f;  // libm is within a few float ulps
+  }
+}
+
+void TanhArray(float* a_data, int a_count, ActivationAccuracy a_accuracy)
+{
+  if (a_accuracy == ActivationAccuracy::TableLinear || a_accuracy == ActivationAccuracy::TableCubic)
+  {
+    const float* table = TanhTable();
+    bool cubic = a_accuracy == ActivationAccuracy::TableCubic;
+    for (int i = 0; i < a_count; i++)
+      a_data[i] = TableTanh(table, a_data[i], cubic);
+    return;
+  }
+
+  if (a_accuracy == ActivationAccuracy::Exact)
+  {
+    for (int i = 0; i < a_count; i++)
+      a_data[i] = tanh(a_data[i]);
+    return;
+  }
+
+  const Exp2Poly& poly = PolyFor(a_accuracy);
+  int i = GetSimdLevel() >= SimdLevel::Avx2 ? TanhAvx2(a_data, a_count, poly) : 0;
+  for (; i < a_count; i++)
+    a_data[i] = 1.0f - 2.0f / (FastExp(2.0f * a_data[i], poly) + 1.0f);
+}
+
+void SigmoidArray(float* a_data, int a_count, ActivationAccuracy a_accuracy)
+{
+  // sigmoid(x) = (1 + tanh(x/2)) / 2
+  if (a_accuracy == ActivationAccuracy::TableLinear || a_accuracy == ActivationAccuracy::TableCubic)
+  {
+    const float* table = TanhTable();
+    bool cubic = a_accuracy == ActivationAccuracy::TableCubic;
+    for (int i = 0; i < a_count; i++)
+      a_data[i] = 0.5f + 0.5f * TableTanh(table, 0.5f * a_data[i], cubic);
+    return;
+  }
+
+  if (a_accuracy == ActivationAccuracy::Exact)
+  {
+    for (int i = 0; i < a_count; i++)
+      a_data[i] = (float)1.0 / (1 + exp(-a_data[i]));
+    return;
+  }
+
+  const Exp2Poly& poly = PolyFor(a_accuracy);
+  int i = GetSimdLevel() >= SimdLevel::Avx2 ? SigmoidAvx2(a_data, a_count, poly) : 0;
+  for (; i < a_count; i++)
+    a_data[i] = 1.0f / (1.0f + FastExp(-a_data[i], poly));
+}
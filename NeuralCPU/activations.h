@@ -0,0 +1,23 @@
+#pragma once
+
+// Accuracy tiers for the array activations.  Exact calls libm; Fast..Tol1e6
+// use a polynomial exp2 approximation of increasing degree, and are
+// vectorized when the CPU supports AVX2; the Table modes interpolate a 2 KB
+// tanh table (sigmoid is derived from it) and clamp outside its range.
+// Errors compound through deep layer stacks, so with BrainCpu's 10 layers
+// only Tol1e6 stays within one 8-bit step.
+enum class ActivationAccuracy
+{
+  Exact,       // libm tanh/exp
+  Fast,        // Abs. error below 1e-3 per activation
+  Tol1e4,      // Abs. error below 1e-4
+  Tol1e6,      // Abs. error below 1e-6
+  TableLinear, // Abs. error below 1e-4
+  TableCubic   // Abs. error below 1e-5
+};
+
+// The per-activation absolute error above, for code that has to bound it
+float ActivationErrorBound(ActivationAccuracy a_accuracy);
+
+void TanhArray(float* a_data, int a_count, ActivationAccuracy a_accuracy);
+void SigmoidArray(float* a_data, int a_count, ActivationAccuracy a_accuracy);
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+// std::allocator replacement returning memory aligned to a_align bytes, so
+// SIMD kernels can use full-width loads that never straddle a cache line
+template <typename T, size_t Align>
+class AlignedAllocator
+{
+public:
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind { typedef AlignedAllocator<U, Align> other; };
+
+  AlignedAllocator() {}
+  template <typename U>
+  AlignedAllocator(const AlignedAllocator<U, Align>&) {}
+
+  T* allocate(size_t a_count)
+  {
+    void* ptr = nullptr;
+#ifdef _MSC_VER
+    ptr = _aligned_malloc(a_count * sizeof(T), Align);
+#else
+    if (posix_memalign(&ptr, Align, a_count * sizeof(T)) != 0)
+      ptr = nullptr;
+#endif
+    if (!ptr)
+      throw std::bad_alloc();
+    return (T*)ptr;
+  }
+
+  void deallocate(T* a_ptr, size_t)
+  {
+#ifdef _MSC_VER
+    _aligned_free(a_ptr);
+#else
+    free(a_ptr);
+#endif
+  }
+
+  template <typename U>
+  bool operator==(const AlignedAllocator<U, Align>&) const { return true; }
+  template <typename U>
+  bool operator!=(const AlignedAllocator<U, Align>&) const { return false; }
+};
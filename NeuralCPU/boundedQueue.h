@@ -0,0 +1,55 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Blocking FIFO with a fixed capacity, for handing work between pipeline
+// stages.  After Close(), pushes fail and pops drain what is left.
+template <typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t a_capacity) :
+    m_capacity(a_capacity) {};
+
+  // Waits for space; returns false if the queue was closed
+  bool Push(const T& a_item)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notFull.wait(lock, [&]() { return m_closed || m_items.size() < m_capacity; });
+    if (m_closed)
+      return false;
+    m_items.push_back(a_item);
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  // Waits for an item; returns false once the queue is closed and empty
+  bool Pop(T& a_item)
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notEmpty.wait(lock, [&]() { return m_closed || !m_items.empty(); });
+    if (m_items.empty())
+      return false;
+    a_item = m_items.front();
+    m_items.pop_front();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closed = true;
+    m_notFull.notify_all();
+    m_notEmpty.notify_all();
+  }
+
+private:
+  size_t m_capacity;
+  bool m_closed = false;
+  std::deque<T> m_items;
+  std::mutex m_mutex;
+  std::condition_variable m_notFull;
+  std::condition_variable m_notEmpty;
+};
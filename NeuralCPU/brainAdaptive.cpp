@@ -0,0 +1,179 @@
+#include "brainCpu.h"
+#include <algorithm>
+
+// Cells are given by their corner pixels, inclusive.  Each cell owns the
+// pixels [x0, x1) x [y0, y1), plus its right column and bottom row on the
+// image border, so the leaves of the quadtree own every pixel exactly once
+// and can be filled in parallel.
+struct AdaptiveCell
+{
+  int x0, y0, x1, y1;
+};
+
+static uint8_t ToByte(float a_value)
+{
+  return (uint8_t)(a_value * 255.0);
+}
+
+BrainCpu::AdaptiveStats BrainCpu::DreamAdaptive(int a_width, int a_height, float a_z, uint8_t* a_dest, int a_tolerance)
+{
+  AdaptiveStats stats = { 0, a_width * a_height };
+  if (a_width <= 0 || a_height <= 0)
+    return stats;
+
+  // Cells whose corners agree can still hide a feature inside, so only
+  // evaluating every pixel is exact
+  if (a_tolerance <= 0)
+  {
+    Dream(a_width, a_height, a_z, a_dest);
+    stats.evaluations = stats.pixels;
+    return stats;
+  }
+
+  ThreadPool& pool = Pool();
+  ComputeTerms(a_width, a_height, a_z, m_terms);
+  m_samples.resize(a_width * a_height * 3);
+  m_sampled.assign(a_width * a_height, 0);
+
+  // Root cells on a s_adaptiveCell lattice, with the last row and column of
+  // corners on the image edge
+  std::vector<int> xs, ys;
+  for (int x = 0; x < a_width - 1; x += s_adaptiveCell)
+    xs.push_back(x);
+  xs.push_back(a_width - 1);
+  for (int y = 0; y < a_height - 1; y += s_adaptiveCell)
+    ys.push_back(y);
+  ys.push_back(a_height - 1);
+
+  std::vector<AdaptiveCell> cells;
+  for (size_t j = 0; j < std::max<size_t>(1, ys.size() - 1); j++)
+    for (size_t i = 0; i < std::max<size_t>(1, xs.size() - 1); i++)
+      cells.push_back({ xs[i], ys[j], xs[std::min(i + 1, xs.size() - 1)], ys[std::min(j + 1, ys.size() - 1)] });
+
+  std::vector<int> points;  // y * a_width + x
+  std::vector<uint8_t> split;
+  while (!cells.empty())
+  {
+    // Evaluate the corners of this level's cells that no earlier level had
+    points.clear();
+    for (const AdaptiveCell& cell : cells)
+    {
+      const int corners[4] = { cell.y0 * a_width + cell.x0, cell.y0 * a_width + cell.x1,
+                               cell.y1 * a_width + cell.x0, cell.y1 * a_width + cell.x1 };
+      for (int corner : corners)
+      {
+        if (!m_sampled[corner])
+        {
+          m_sampled[corner] = 1;
+          points.push_back(corner);
+        }
+      }
+    }
+    stats.evaluations += (int)points.size();
+
+    int batches = ((int)points.size() + s_batchSize - 1) / s_batchSize;
+    pool.ParallelFor(batches, [&](int a_batch, int a_worker)
+    {
+      BatchScratch& scratch = m_scratch[a_worker];
+      ReserveBatch(s_batchSize, scratch);
+      if ((int)scratch.pixels.size() < s_batchSize)
+        scratch.pixels.resize(s_batchSize);
+
+      const int* batch = points.data() + a_batch * s_batchSize;
+      int count = std::min(s_batchSize, (int)points.size() - a_batch * s_batchSize);
+      for (int n = 0; n < s_networkSize; n++)
+      {
+        float* act = &scratch.a.At(n, 0);
+        for (int i = 0; i < count; i++)
+          act[i] = (m_terms.columns[n * a_width + batch[i] % a_width] + m_terms.rows[n * a_height + batch[i] / a_width]) + m_terms.depth[n];
+      }
+
+      ThinkFromFirstLayer(count, scratch.pixels.data(), scratch);
+
+      for (int i = 0; i < count; i++)
+      {
+        for (int c = 0; c < 3; c++)
+        {
+          m_samples[batch[i] * 3 + c] = scratch.pixels[i].m_storage[c];
+          a_dest[batch[i] * 3 + c] = ToByte(scratch.pixels[i].m_storage[c]);
+        }
+      }
+    });
+
+    // Split cells whose corners disagree, fill the rest
+    split.assign(cells.size(), 0);
+    static const int s_cellsPerJob = 64;
+    int jobs = ((int)cells.size() + s_cellsPerJob - 1) / s_cellsPerJob;
+    pool.ParallelFor(jobs, [&](int a_job, int)
+    {
+      for (int i = a_job * s_cellsPerJob; i < std::min((int)cells.size(), (a_job + 1) * s_cellsPerJob); i++)
+      {
+        const AdaptiveCell& cell = cells[i];
+        const float* corner[4] = { &m_samples[(cell.y0 * a_width + cell.x0) * 3], &m_samples[(cell.y0 * a_width + cell.x1) * 3],
+                                   &m_samples[(cell.y1 * a_width + cell.x0) * 3], &m_samples[(cell.y1 * a_width + cell.x1) * 3] };
+
+        if (cell.x1 - cell.x0 >= 2 || cell.y1 - cell.y0 >= 2)
+        {
+          int spread = 0;
+          for (int c = 0; c < 3; c++)
+          {
+            int lo = 255, hi = 0;
+            for (int k = 0; k < 4; k++)
+            {
+              lo = std::min(lo, (int)ToByte(corner[k][c]));
+              hi = std::max(hi, (int)ToByte(corner[k][c]));
+            }
+            spread = std::max(spread, hi - lo);
+          }
+          if (spread > a_tolerance)
+          {
+            split[i] = 1;
+            continue;
+          }
+        }
+
+        int xEnd = cell.x1 == a_width - 1 ? cell.x1 : cell.x1 - 1;
+        int yEnd = cell.y1 == a_height - 1 ? cell.y1 : cell.y1 - 1;
+        float width  = (float)std::max(1, cell.x1 - cell.x0);
+        float height = (float)std::max(1, cell.y1 - cell.y0);
+        for (int y = cell.y0; y <= yEnd; y++)
+        {
+          float v = (y - cell.y0) / height;
+          for (int x = cell.x0; x <= xEnd; x++)
+          {
+            if (m_sampled[y * a_width + x])
+              continue;
+            float u = (x - cell.x0) / width;
+            for (int c = 0; c < 3; c++)
+            {
+              float top    = corner[0][c] + (corner[1][c] - corner[0][c]) * u;
+              float bottom = corner[2][c] + (corner[3][c] - corner[2][c]) * u;
+              a_dest[(y * a_width + x) * 3 + c] = ToByte(top + (bottom - top) * v);
+            }
+          }
+        }
+      }
+    });
+
+    // Children in cell order, so the next level is the same for any thread count
+    std::vector<AdaptiveCell> children;
+    for (size_t i = 0; i < cells.size(); i++)
+    {
+      if (!split[i])
+        continue;
+      const AdaptiveCell& cell = cells[i];
+      int xm = cell.x1 - cell.x0 >= 2 ? (cell.x0 + cell.x1) / 2 : cell.x1;
+      int ym = cell.y1 - cell.y0 >= 2 ? (cell.y0 + cell.y1) / 2 : cell.y1;
+      children.push_back({ cell.x0, cell.y0, xm, ym });
+      if (xm != cell.x1)
+        children.push_back({ xm, cell.y0, cell.x1, ym });
+      if (ym != cell.y1)
+        children.push_back({ cell.x0, ym, xm, cell.y1 });
+      if (xm != cell.x1 && ym != cell.y1)
+        children.push_back({ xm, ym, cell.x1, cell.y1 });
+    }
+    cells.swap(children);
+  }
+
+  return stats;
+}
@@ -1,46 +1,560 @@
 #include "brainCpu.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
 #include <random>
 
+// Bound by reference in std::min, so it needs a definition
+const int BrainCpu::s_batchSize;
+
 BrainCpu::BrainCpu()
 {
-  // Allocate layers
-  m_layerInput = Matrix<float>(s_networkSize, s_nIn);
-  for (auto& layer : m_layersHidden)
-    layer = Matrix<float>(s_networkSize, s_networkSize);
-  m_layerOutput = Matrix<float>(s_nOut, s_networkSize);
-
   // Fill the layers with random numbers
   std::random_device rand;
   std::uniform_real_distribution<float> dist(-1, 1);
 
-  m_layerInput.Fill([&]() { return dist(rand); });
-  for (auto &layer : m_layersHidden)
+  m_layers.input.Fill([&]() { return dist(rand); });
+  for (auto &layer : m_layers.hidden)
     layer.Fill([&]() { return dist(rand); });
-  m_layerOutput.Fill([&]() { return dist(rand); });
+  m_layers.output.Fill([&]() { return dist(rand); });
 }
 
 Pixel<float> BrainCpu::Think(float x, float y, float z)
 {
-  Matrix<float> input(3, 1, { x, y, z });
+  FixedMatrix<float, s_nIn, 1> input = { { x, y, z } };
+  FixedMatrix<float, s_networkSize, 1> a, b;
+  FixedMatrix<float, s_nOut, 1> out;
 
-  Matrix<float> out = m_layerInput.Multiply(input).Tanh();
-  for (auto& layer : m_layersHidden)
-    out = layer.Multiply(out).Tanh();
-  out = m_layerOutput.Multiply(out).Sigmoid();
+  m_layers.input.MultiplyInto(input, a);
+  TanhArray(a.m_storage.data(), s_networkSize, m_accuracy);
+  for (auto& layer : m_layers.hidden)
+  {
+    layer.MultiplyInto(a, b);
+    TanhArray(b.m_storage.data(), s_networkSize, m_accuracy);
+    a = b;
+  }
+  m_layers.output.MultiplyInto(a, out);
+  SigmoidArray(out.m_storage.data(), s_nOut, m_accuracy);
 
   return Pixel<float> { out.m_storage[0], out.m_storage[1], out.m_storage[2] };
 }
 
+void BrainCpu::SetThreadCount(int a_threads)
+{
+  m_threadCount = a_threads;
+  m_pool.reset();
+}
+
+void BrainCpu::SetNumaPlacement(bool a_enabled)
+{
+  m_numa = a_enabled;
+  m_pool.reset();
+}
+
+ThreadPool& BrainCpu::Pool()
+{
+  if (!m_pool)
+  {
+    int threads = m_threadCount > 0 ? m_threadCount : (int)std::thread::hardware_concurrency();
+    m_pool.reset(new ThreadPool(std::max(1, threads), m_numa));
+    m_scratch.resize(std::max((int)m_scratch.size(), m_pool->Size()));
+    for (BatchScratch& scratch : m_scratch)
+      scratch.layers = nullptr;
+    m_replicas.clear();
+
+    if (m_pool->Nodes() > 1)
+    {
+      // Each replica is allocated and first written by the first pinned
+      // worker of its node, which is where the OS puts its pages.  m_layers
+      // never changes after construction, so the copies stay current.
+      m_replicas.resize(m_pool->Nodes());
+      m_pool->ForEachWorker([&](int a_worker)
+      {
+        int node = m_pool->NodeOf(a_worker);
+        if (m_pool->IsPinned(a_worker) && (a_worker == 0 || m_pool->NodeOf(a_worker - 1) != node))
+          m_replicas[node].reset(new Layers(m_layers));
+      });
+      // Only a node whose one worker is the unpinned calling thread is left
+      for (auto& replica : m_replicas)
+        if (!replica)
+          replica.reset(new Layers(m_layers));
+      for (int worker = 0; worker < m_pool->Size(); worker++)
+        m_scratch[worker].layers = m_replicas[m_pool->NodeOf(worker)].get();
+    }
+  }
+  return *m_pool;
+}
+
+void BrainCpu::ThinkBatch(const float* a_x, const float* a_y, const float* a_z, int a_count, Pixel<float>* a_out)
+{
+  if (m_scratch.empty())
+    m_scratch.resize(1);
+  ThinkBatch(a_x, a_y, a_z, a_count, a_out, m_scratch[0]);
+}
+
+void BrainCpu::ReserveBatch(int a_count, BatchScratch& a_scratch)
+{
+  if (a_scratch.in.m_height < a_count)
+  {
+    a_scratch.in  = Matrix<float>(s_nIn, a_count);
+    a_scratch.a   = Matrix<float>(s_networkSize, a_count);
+    a_scratch.b   = Matrix<float>(s_networkSize, a_count);
+    a_scratch.out = Matrix<float>(s_nOut, a_count);
+  }
+}
+
+void BrainCpu::ThinkBatch(const float* a_x, const float* a_y, const float* a_z, int a_count, Pixel<float>* a_out, BatchScratch& a_scratch)
+{
+  ReserveBatch(a_count, a_scratch);
+
+  // Only the first a_count columns of the scratch matrices are used
+  Matrix<float>& in = a_scratch.in;
+  std::copy(a_x, a_x + a_count, &in.At(0, 0));
+  std::copy(a_y, a_y + a_count, &in.At(1, 0));
+  std::copy(a_z, a_z + a_count, &in.At(2, 0));
+
+  MultiplyKernel(LayersFor(a_scratch).input.m_storage.data(), s_nIn, in.m_storage.data(), in.m_stride,
+                 a_scratch.a.m_storage.data(), a_scratch.a.m_stride, s_networkSize, s_nIn, a_count);
+  ThinkFromFirstLayer(a_count, a_out, a_scratch);
+}
+
+void BrainCpu::ThinkFromFirstLayer(int a_count, Pixel<float>* a_out, BatchScratch& a_scratch)
+{
+  Matrix<float>& out = a_scratch.out;
+  Matrix<float>* act  = &a_scratch.a;
+  Matrix<float>* next = &a_scratch.b;
+  const Layers& layers = LayersFor(a_scratch);
+
+  for (int n = 0; n < s_networkSize; n++)
+    TanhArray(&act->At(n, 0), a_count, m_accuracy);
+
+  for (auto& layer : layers.hidden)
+  {
+    MultiplyKernel(layer.m_storage.data(), s_networkSize, act->m_storage.data(), act->m_stride,
+                   next->m_storage.data(), next->m_stride, s_networkSize, s_networkSize, a_count);
+    for (int n = 0; n < s_networkSize; n++)
+      TanhArray(&next->At(n, 0), a_count, m_accuracy);
+    std::swap(act, next);
+  }
+
+  MultiplyKernel(layers.output.m_storage.data(), s_networkSize, act->m_storage.data(), act->m_stride,
+                 out.m_storage.data(), out.m_stride, s_nOut, s_networkSize, a_count);
+  for (int n = 0; n < s_nOut; n++)
+    SigmoidArray(&out.At(n, 0), a_count, m_accuracy);
+
+  for (int i = 0; i < a_count; i++)
+    a_out[i] = Pixel<float> { out.At(0, i), out.At(1, i), out.At(2, i) };
+}
+
 void BrainCpu::Dream(int a_width, int a_height, float a_z, uint8_t* a_dest)
 {
-  for (int y = 0; y < a_height; y++)
+  Dream(a_width, a_height, a_z, a_dest, TileCallback());
+}
+
+void BrainCpu::Dream(int a_width, int a_height, float a_z, uint8_t* a_dest, const TileCallback& a_onTile)
+{
+  ComputeTerms(a_width, a_height, a_z, m_terms);
+  PlanTiles(a_width, a_height, Pool().Size());
+  DreamTiles(a_width, a_height, a_dest, a_onTile, Deadline::max(), nullptr);
+}
+
+float BrainCpu::Dream(int a_width, int a_height, float a_z, uint8_t* a_dest, Deadline a_deadline, const std::atomic<bool>* a_cancel)
+{
+  if (a_width <= 0 || a_height <= 0)
+    return 1.0f;
+
+  ComputeTerms(a_width, a_height, a_z, m_terms);
+  DreamPass(a_width, a_height, a_dest, s_coarseBlock);
+  PlanTiles(a_width, a_height, Pool().Size());
+  int done = DreamTiles(a_width, a_height, a_dest, TileCallback(), a_deadline, a_cancel);
+  return (float)done / ((float)a_width * a_height);
+}
+
+void BrainCpu::DreamProgressive(int a_width, int a_height, float a_z, uint8_t* a_dest, const PassCallback& a_onPass)
+{
+  ComputeTerms(a_width, a_height, a_z, m_terms);
+  for (int stride = s_coarseBlock; stride >= 1; stride /= 2)
+  {
+    DreamPass(a_width, a_height, a_dest, stride);
+    if (a_onPass)
+      a_onPass(stride);
+  }
+}
+
+int BrainCpu::DreamTiles(int a_width, int a_height, uint8_t* a_dest, const TileCallback& a_onTile,
+                         Deadline a_deadline, const std::atomic<bool>* a_cancel)
+{
+  ThreadPool& pool = Pool();
+  bool lanes = m_engine == DreamEngine::Lanes && GetSimdLevel() >= SimdLevel::Avx2;
+  bool bounded = a_deadline != Deadline::max() || a_cancel;
+  std::atomic<int> done(0);
+
+  // Once one worker sees the deadline pass, the rest stop without checking the clock
+  std::atomic<bool> expired(false);
+  auto stop = [&]()
+  {
+    if (!bounded)
+      return false;
+    if (expired.load(std::memory_order_relaxed))
+      return true;
+    if ((a_cancel && a_cancel->load(std::memory_order_relaxed)) || std::chrono::steady_clock::now() >= a_deadline)
+    {
+      expired.store(true, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  };
+
+  if (m_schedule == TileSchedule::Stealing)
+  {
+    pool.ParallelForStealing((int)m_tiles.size(), [&](int a_tile, int a_worker)
+    {
+      const Tile& tile = m_tiles[a_tile];
+      if (stop())
+        return;
+      DreamTile(a_width, a_height, m_terms, a_dest, tile, lanes, m_scratch[a_worker]);
+      done.fetch_add((tile.x1 - tile.x0) * (tile.y1 - tile.y0), std::memory_order_relaxed);
+      if (a_onTile)
+        a_onTile(tile.x0, tile.y0, tile.x1, tile.y1);
+    });
+    return done;
+  }
+
+  // Tiles are sorted most expensive first, and ParallelFor hands them out in
+  // order to whichever worker frees up first: longest-processing-time first.
+  // Skipped tiles keep their estimate so the next plan isn't thrown off.
+  pool.ParallelFor((int)m_tiles.size(), [&](int a_tile, int a_worker)
+  {
+    Tile& tile = m_tiles[a_tile];
+    if (stop())
+      return;
+    auto start = std::chrono::steady_clock::now();
+    DreamTile(a_width, a_height, m_terms, a_dest, tile, lanes, m_scratch[a_worker]);
+    tile.cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    done.fetch_add((tile.x1 - tile.x0) * (tile.y1 - tile.y0), std::memory_order_relaxed);
+    if (a_onTile)
+      a_onTile(tile.x0, tile.y0, tile.x1, tile.y1);
+  });
+
+  std::fill(m_gridCosts.begin(), m_gridCosts.end(), 0.0);
+  for (const Tile& tile : m_tiles)
+    m_gridCosts[tile.base] += tile.cost;
+  return done;
+}
+
+void BrainCpu::FirstTouch(int a_width, int a_height, uint8_t* a_dest)
+{
+  ThreadPool& pool = Pool();
+  PlanTiles(a_width, a_height, pool.Size());
+
+  // The stealing schedule deals each worker a contiguous block of tiles up
+  // front, as ParallelForStealing does.  The cost model hands tiles out in
+  // plan order as workers free up, which comes to every Size()-th tile
+  // while they take about as long as each other.
+  int tiles = (int)m_tiles.size();
+  int workers = pool.Size();
+  pool.ForEachWorker([&](int a_worker)
+  {
+    bool blocks = m_schedule == TileSchedule::Stealing;
+    int first = blocks ? (int)((long long)tiles * a_worker / workers) : a_worker;
+    int end   = blocks ? (int)((long long)tiles * (a_worker + 1) / workers) : tiles;
+    for (int i = first; i < end; i += blocks ? 1 : workers)
+    {
+      const Tile& tile = m_tiles[i];
+      for (int y = tile.y0; y < tile.y1; y++)
+        std::fill(a_dest + (y * a_width + tile.x0) * 3, a_dest + (y * a_width + tile.x1) * 3, (uint8_t)0);
+    }
+  });
+}
+
+void BrainCpu::DreamPass(int a_width, int a_height, uint8_t* a_dest, int a_stride)
+{
+  ThreadPool& pool = Pool();
+
+  int latticeRows = (a_height + a_stride - 1) / a_stride;
+  pool.ParallelFor(latticeRows, [&](int a_row, int a_worker)
+  {
+    BatchScratch& scratch = m_scratch[a_worker];
+    ReserveBatch(s_batchSize, scratch);
+    if ((int)scratch.pixels.size() < s_batchSize)
+      scratch.pixels.resize(s_batchSize);
+
+    // Rows the previous pass sampled already have the even multiples of the stride
+    int y = a_row * a_stride;
+    bool sampled = a_stride < s_coarseBlock && y % (2 * a_stride) == 0;
+    int firstX = sampled ? a_stride : 0;
+    int stepX  = sampled ? 2 * a_stride : a_stride;
+    int count  = firstX < a_width ? (a_width - firstX + stepX - 1) / stepX : 0;
+    int blockHeight = std::min(a_stride, a_height - y);
+
+    for (int start = 0; start < count; start += s_batchSize)
+    {
+      int batch = std::min(s_batchSize, count - start);
+      for (int n = 0; n < s_networkSize; n++)
+      {
+        const float* columns = &m_terms.columns[n * a_width];
+        float row = m_terms.rows[n * a_height + y];
+        float* act = &scratch.a.At(n, 0);
+        for (int i = 0; i < batch; i++)
+          act[i] = (columns[firstX + (start + i) * stepX] + row) + m_terms.depth[n];
+      }
+
+      ThinkFromFirstLayer(batch, scratch.pixels.data(), scratch);
+
+      for (int i = 0; i < batch; i++)
+      {
+        int x = firstX + (start + i) * stepX;
+        const Pixel<float>& color = scratch.pixels[i];
+        uint8_t rgb[3] = { (uint8_t)(color.m_storage[0] * 255.0), (uint8_t)(color.m_storage[1] * 255.0), (uint8_t)(color.m_storage[2] * 255.0) };
+        int blockWidth = std::min(a_stride, a_width - x);
+        for (int by = 0; by < blockHeight; by++)
+        {
+          uint8_t* dest = a_dest + ((y + by) * a_width + x) * 3;
+          for (int bx = 0; bx < blockWidth; bx++, dest += 3)
+          {
+            dest[0] = rgb[0];
+            dest[1] = rgb[1];
+            dest[2] = rgb[2];
+          }
+        }
+      }
+    }
+  });
+}
+
+BrainCpu::DreamJob BrainCpu::StartDream(int a_width, int a_height, float a_z, uint8_t* a_dest)
+{
+  return DreamJob(*this, a_width, a_height, a_z, a_dest);
+}
+
+BrainCpu::DreamJob::DreamJob(BrainCpu& a_brain, int a_width, int a_height, float a_z, uint8_t* a_dest) :
+  m_brain(&a_brain), m_width(a_width), m_height(a_height), m_dest(a_dest),
+  m_lanes(a_brain.m_engine == DreamEngine::Lanes && GetSimdLevel() >= SimdLevel::Avx2)
+{
+  a_brain.ComputeTerms(a_width, a_height, a_z, m_terms);
+
+  int tileSize = std::max(1, a_brain.m_tileSize);
+  for (int y0 = 0; y0 < a_height; y0 += tileSize)
+    for (int x0 = 0; x0 < a_width; x0 += tileSize)
+      m_tiles.push_back({ x0, y0, std::min(a_width, x0 + tileSize), std::min(a_height, y0 + tileSize), 0, 0.0 });
+}
+
+bool BrainCpu::DreamJob::Next(int& a_x0, int& a_y0, int& a_x1, int& a_y1)
+{
+  if (Done())
+    return false;
+
+  const Tile& tile = m_tiles[m_next++];
+  m_brain->DreamTile(m_width, m_height, m_terms, m_dest, tile, m_lanes, m_scratch);
+  m_pixelsDone += (tile.x1 - tile.x0) * (tile.y1 - tile.y0);
+  a_x0 = tile.x0;
+  a_y0 = tile.y0;
+  a_x1 = tile.x1;
+  a_y1 = tile.y1;
+  return true;
+}
+
+void BrainCpu::PlanTiles(int a_width, int a_height, int a_threads)
+{
+  int tileSize = std::max(1, m_tileSize);
+  int tilesX = (a_width + tileSize - 1) / tileSize;
+  int tilesY = (a_height + tileSize - 1) / tileSize;
+
+  // Costs only carry over between frames with the same grid
+  if (a_width != m_gridWidth || a_height != m_gridHeight || tileSize != m_gridTileSize)
+  {
+    m_gridWidth    = a_width;
+    m_gridHeight   = a_height;
+    m_gridTileSize = tileSize;
+    m_gridCosts.assign(tilesX * tilesY, 0.0);
+  }
+
+  double total = 0.0;
+  if (m_schedule == TileSchedule::CostModel)
+    for (double cost : m_gridCosts)
+      total += cost;
+
+  // Aim for a few tiles per thread, so the last one to finish is short
+  static const int s_tilesPerThread = 4;
+  double target = total / (a_threads * s_tilesPerThread);
+
+  m_tiles.clear();
+  for (int i = 0; i < tilesX * tilesY; i++)
+  {
+    int x0 = (i % tilesX) * tileSize;
+    int y0 = (i / tilesX) * tileSize;
+    Tile tile = { x0, y0, std::min(a_width, x0 + tileSize), std::min(a_height, y0 + tileSize), i, m_gridCosts[i] };
+    if (total > 0.0)
+      SplitTile(tile, target);
+    else
+      m_tiles.push_back(tile);
+  }
+
+  // Ties go by position, so the order is fixed without stable_sort's
+  // temporary buffer
+  if (total > 0.0)
+    std::sort(m_tiles.begin(), m_tiles.end(), [](const Tile& a_a, const Tile& a_b)
+    {
+      if (a_a.cost != a_b.cost)
+        return a_a.cost > a_b.cost;
+      if (a_a.y0 != a_b.y0)
+        return a_a.y0 < a_b.y0;
+      return a_a.x0 < a_b.x0;
+    });
+}
+
+// Quarters a tile, assuming its cost is spread evenly, until each piece is
+// under the target or too small to be worth splitting
+void BrainCpu::SplitTile(const Tile& a_tile, double a_target)
+{
+  static const int s_minTileSize = 8;
+  int width  = a_tile.x1 - a_tile.x0;
+  int height = a_tile.y1 - a_tile.y0;
+  if (a_tile.cost <= a_target || width < 2 * s_minTileSize || height < 2 * s_minTileSize)
+  {
+    m_tiles.push_back(a_tile);
+    return;
+  }
+
+  int xm = a_tile.x0 + width / 2;
+  int ym = a_tile.y0 + height / 2;
+  double cost = a_tile.cost / 4;
+  SplitTile({ a_tile.x0, a_tile.y0, xm, ym, a_tile.base, cost }, a_target);
+  SplitTile({ xm, a_tile.y0, a_tile.x1, ym, a_tile.base, cost }, a_target);
+  SplitTile({ a_tile.x0, ym, xm, a_tile.y1, a_tile.base, cost }, a_target);
+  SplitTile({ xm, ym, a_tile.x1, a_tile.y1, a_tile.base, cost }, a_target);
+}
+
+void BrainCpu::ComputeTerms(int a_width, int a_height, float a_z, FirstLayerTerms& a_terms) const
+{
+  // Products are exact to one rounding, like the first step of the kernel's dot
+  const float* weights = m_layers.input.m_storage.data();
+  a_terms.width  = a_width;
+  a_terms.height = a_height;
+  a_terms.columns.resize(s_networkSize * a_width);
+  a_terms.rows.resize(s_networkSize * a_height);
+  for (int n = 0; n < s_networkSize; n++)
   {
     for (int x = 0; x < a_width; x++)
+      a_terms.columns[n * a_width + x] = weights[n * s_nIn + 0] * ((float)x / a_width - 0.5f);
+    for (int y = 0; y < a_height; y++)
+      a_terms.rows[n * a_height + y] = weights[n * s_nIn + 1] * ((float)y / a_height - 0.5f);
+    a_terms.depth[n] = weights[n * s_nIn + 2] * a_z;
+  }
+}
+
+void BrainCpu::DreamTile(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest, const Tile& a_tile, bool a_lanes, BatchScratch& a_scratch)
+{
+  DreamRect(a_width, a_height, a_terms, a_dest, a_tile.x0, a_tile.y0, a_tile.x1, a_tile.y1, a_lanes, a_scratch);
+}
+
+void BrainCpu::DreamRect(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest,
+                         int a_x0, int a_y0, int a_x1, int a_y1, bool a_lanes, BatchScratch& a_scratch)
+{
+  if (m_intervalCulling && CullRect(a_width, a_height, a_terms, a_dest, a_x0, a_y0, a_x1, a_y1, a_lanes, a_scratch))
+    return;
+
+  if (a_lanes)
+    DreamLanes(a_width, a_height, a_terms, a_dest, a_x0, a_y0, a_x1, a_y1, LayersFor(a_scratch));
+  else
+    DreamBatch(a_width, a_height, a_terms, a_dest, a_x0, a_y0, a_x1, a_y1, a_scratch);
+}
+
+static void FillRect(int a_width, uint8_t* a_dest, int a_x0, int a_y0, int a_x1, int a_y1, const uint8_t* a_rgb)
+{
+  for (int y = a_y0; y < a_y1; y++)
+  {
+    uint8_t* dest = a_dest + (y * a_width + a_x0) * 3;
+    for (int x = a_x0; x < a_x1; x++, dest += 3)
+    {
+      dest[0] = a_rgb[0];
+      dest[1] = a_rgb[1];
+      dest[2] = a_rgb[2];
+    }
+  }
+}
+
+bool BrainCpu::CullRect(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest,
+                        int a_x0, int a_y0, int a_x1, int a_y1, bool a_lanes, BatchScratch& a_scratch)
+{
+  const Layers& layers = LayersFor(a_scratch);
+  uint8_t rgb[3];
+  int spread = ColorSpread(a_terms, a_x0, a_y0, a_x1, a_y1, layers, rgb);
+  if (spread == 0)
+  {
+    FillRect(a_width, a_dest, a_x0, a_y0, a_x1, a_y1, rgb);
+    return true;
+  }
+
+  // The bounds shrink about in proportion to the box, so a split is only
+  // worth trying when the descendants could get down to one level before
+  // s_minCullSize
+  int size = std::min(a_x1 - a_x0, a_y1 - a_y0);
+  if (size < 2 * s_minCullSize || spread * s_minCullSize > size)
+    return false;
+
+  // Small boxes run the engines less efficiently, so only split if some
+  // quarter comes out flat.  Pixels are the same however a tile is cut.
+  int xm = (a_x0 + a_x1) / 2;
+  int ym = (a_y0 + a_y1) / 2;
+  const int quarters[4][4] = { { a_x0, a_y0, xm, ym }, { xm, a_y0, a_x1, ym }, { a_x0, ym, xm, a_y1 }, { xm, ym, a_x1, a_y1 } };
+  uint8_t colors[4][3];
+  bool flat[4], anyFlat = false;
+  for (int q = 0; q < 4; q++)
+  {
+    flat[q] = ColorSpread(a_terms, quarters[q][0], quarters[q][1], quarters[q][2], quarters[q][3], layers, colors[q]) == 0;
+    anyFlat |= flat[q];
+  }
+  if (!anyFlat)
+    return false;
+
+  for (int q = 0; q < 4; q++)
+  {
+    if (flat[q])
+      FillRect(a_width, a_dest, quarters[q][0], quarters[q][1], quarters[q][2], quarters[q][3], colors[q]);
+    else
+      DreamRect(a_width, a_height, a_terms, a_dest, quarters[q][0], quarters[q][1], quarters[q][2], quarters[q][3], a_lanes, a_scratch);
+  }
+  return true;
+}
+
+void BrainCpu::DreamBatch(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest,
+                          int a_x0, int a_y0, int a_x1, int a_y1, BatchScratch& a_scratch)
+{
+  ReserveBatch(s_batchSize, a_scratch);
+  if ((int)a_scratch.pixels.size() < s_batchSize)
+    a_scratch.pixels.resize(s_batchSize);
+
+  // Walk the tile in raster order, s_batchSize pixels at a time
+  int tileWidth = a_x1 - a_x0;
+  int total = tileWidth * (a_y1 - a_y0);
+  for (int start = 0; start < total; start += s_batchSize)
+  {
+    int count = std::min(s_batchSize, total - start);
+    for (int n = 0; n < s_networkSize; n++)
     {
-      Pixel<float> color = Think((float)x / a_width - 0.5f, (float)y / a_height - 0.5f, a_z);
-      *a_dest++ = (uint8_t)(color.m_storage[0] * 255.0);
-      *a_dest++ = (uint8_t)(color.m_storage[1] * 255.0);
-      *a_dest++ = (uint8_t)(color.m_storage[2] * 255.0);
+      const float* columns = &a_terms.columns[n * a_width];
+      const float* rows = &a_terms.rows[n * a_height];
+      float* act = &a_scratch.a.At(n, 0);
+      for (int i = 0; i < count; i++)
+      {
+        int x = a_x0 + (start + i) % tileWidth;
+        int y = a_y0 + (start + i) / tileWidth;
+        act[i] = (columns[x] + rows[y]) + a_terms.depth[n];
+      }
+    }
+
+    ThinkFromFirstLayer(count, a_scratch.pixels.data(), a_scratch);
+
+    for (int i = 0; i < count; i++)
+    {
+      int x = a_x0 + (start + i) % tileWidth;
+      int y = a_y0 + (start + i) / tileWidth;
+      const Pixel<float>& color = a_scratch.pixels[i];
+      uint8_t* dest = a_dest + (y * a_width + x) * 3;
+      dest[0] = (uint8_t)(color.m_storage[0] * 255.0);
+      dest[1] = (uint8_t)(color.m_storage[1] * 255.0);
+      dest[2] = (uint8_t)(color.m_storage[2] * 255.0);
     }
   }
-}
\ No newline at end of file
+}
@@ -1,64 +1,143 @@
 #pragma once
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
 #include <vector>
 #include <functional>
+#include <memory>
 #include <cstdint>
+#include <cmath>
+#include "activations.h"
+#include "alignedAllocator.h"
+#include "dual.h"
+#include "matrixSimd.h"
+#include "threadPool.h"
 
+// Plain triple loop for any element type; float is routed to the SIMD kernels.
+// a_lda, a_ldb and a_ldo are the row pitches of the three matrices.
+template <typename T>
+void MultiplyKernel(const T* a_a, int a_lda, const T* a_b, int a_ldb, T* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  for (int x = 0; x < a_rows; x++)
+  {
+    for (int y = 0; y < a_cols; y++)
+    {
+      T dot = 0;
+      for (int k = 0; k < a_inner; k++)
+        dot += a_a[a_lda*x + k] * a_b[a_ldb*k + y];
+      a_out[a_ldo*x + y] = dot;
+    }
+  }
+}
+
+inline void MultiplyKernel(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  MultiplyFloat(a_a, a_lda, a_b, a_ldb, a_out, a_ldo, a_rows, a_inner, a_cols);
+}
+
+// Row-major matrix of m_width rows by m_height columns.  Storage is 64-byte
+// aligned and each row is padded to a multiple of the SIMD width (m_stride
+// elements), with the padding kept at zero so kernels can run whole vectors
+// past the logical edge without tail handling.  Single-column matrices
+// (vectors) are stored densely and only padded at the end.
 template <typename T>
 class Matrix
 {
 public:
+  static const int s_alignment = 64;
+  static const int s_lanes     = s_alignment / sizeof(T);
+
   Matrix(int a_width = 0, int a_height = 0) :
-    m_width(a_width), m_height(a_height), m_storage(a_width * a_height) {};
+    m_width(a_width), m_height(a_height), m_stride(PaddedStride(a_height)),
+    m_storage(PaddedSize(a_width * m_stride)) {};
 
   Matrix(int a_width, int a_height, std::initializer_list<T> a_init) :
-    m_width(a_width), m_height(a_height), m_storage(a_init) {};
+    Matrix(a_width, a_height)
+  {
+    auto it = a_init.begin();
+    for (int x = 0; x < m_width; x++)
+      for (int k = 0; k < m_height && it != a_init.end(); k++)
+        At(x, k) = *it++;
+  }
 
-  void Fill(std::function<T()> a_func)
+  static int PaddedSize(int a_count)
   {
-    for (int i = 0; i < m_width*m_height; i++)
-      m_storage[i] = a_func();
+    return (a_count + s_lanes - 1) / s_lanes * s_lanes;
   }
 
-  Matrix<T> Multiply(Matrix<T> a_other)
+  static int PaddedStride(int a_height)
   {
-    if (m_height != a_other.m_width)
-      throw std::invalid_argument("Incompatible array dimensions!");
+    return a_height == 1 ? 1 : PaddedSize(a_height);
+  }
 
-    Matrix<T> result(m_width, a_other.m_height);
+  T& At(int a_x, int a_k)             { return m_storage[m_stride*a_x + a_k]; }
+  const T& At(int a_x, int a_k) const { return m_storage[m_stride*a_x + a_k]; }
 
+  void Fill(std::function<T()> a_func)
+  {
     for (int x = 0; x < m_width; x++)
-    {
-      for (int y = 0; y < a_other.m_height; y++)
-      {
-        T dot = 0;
-        for (int k = 0; k < m_height; k++)
-          dot += m_storage[m_height*x + k] * a_other.m_storage[a_other.m_height*k + y];
-        result.m_storage[a_other.m_height*x + y] = dot;
-      }
-    }
+      for (int k = 0; k < m_height; k++)
+        At(x, k) = a_func();
+  }
 
-    return result;
+  int m_width, m_height, m_stride;
+  std::vector<T, AlignedAllocator<T, s_alignment>> m_storage;
+};
+
+// Calls a_func(0) ... a_func(N-1), expanded at compile time
+template <int N>
+struct Unroll
+{
+  template <typename F>
+  static void Run(F& a_func)
+  {
+    Unroll<N - 1>::Run(a_func);
+    a_func(N - 1);
   }
+};
+
+template <>
+struct Unroll<0>
+{
+  template <typename F>
+  static void Run(F&) {}
+};
+
+// Matrix whose shape is part of its type.  Storage lives inline, shapes are
+// checked by the compiler, and every loop is fully unrolled, so small
+// networks need no heap, no bounds checks and no dimension checks.
+template <typename T, int Rows, int Cols>
+class FixedMatrix
+{
+public:
+  static constexpr int s_rows = Rows;
+  static constexpr int s_cols = Cols;
 
-  Matrix<T> Tanh()
+  void Fill(std::function<T()> a_func)
   {
-    Matrix<T> result(m_width, m_height);
-    for (int i = 0; i < m_storage.size(); i++)
-      result.m_storage[i] = tanh(m_storage[i]);
-    return result;
+    for (int i = 0; i < Rows*Cols; i++)
+      m_storage[i] = a_func();
   }
 
-  Matrix<T> Sigmoid()
+  template <int N>
+  void MultiplyInto(const FixedMatrix<T, Cols, N>& a_other, FixedMatrix<T, Rows, N>& a_result) const
   {
-    Matrix<T> result(m_width, m_height);
-    for (int i = 0; i < m_storage.size(); i++)
-      result.m_storage[i] = (T)1.0 / (1 + exp(-m_storage[i]));
-    return result;
+    auto row = [&](int x)
+    {
+      auto col = [&](int y)
+      {
+        T dot = 0;
+        auto term = [&](int k) { dot += m_storage[Cols*x + k] * a_other.m_storage[N*k + y]; };
+        Unroll<Cols>::Run(term);
+        a_result.m_storage[N*x + y] = dot;
+      };
+      Unroll<N>::Run(col);
+    };
+    Unroll<Rows>::Run(row);
   }
 
-  int m_width, m_height;
-  std::vector<T> m_storage;
+  std::array<T, Rows*Cols> m_storage;
 };
 
 template <typename T>
@@ -68,21 +147,259 @@ public:
   std::array<T, 3> m_storage;
 };
 
+// How Dream evaluates the network
+enum class DreamEngine
+{
+  Batch,  // ThinkBatch over raster-order batches, one GEMM per layer
+  Lanes   // One pixel per SIMD lane (8 with AVX2, 16 with AVX-512); falls back to Batch without AVX2
+};
+
+// How Dream orders its tiles across threads
+enum class TileSchedule
+{
+  Stealing,  // Fixed grid, dealt out in blocks with work stealing
+  CostModel  // Uses the previous frame's per-tile timings: splits expensive tiles and runs the largest first (LPT)
+};
+
 class BrainCpu
 {
 public:
   BrainCpu();
 
+  // Selects the tanh/sigmoid implementation used by Think; defaults to Exact
+  void SetActivationAccuracy(ActivationAccuracy a_accuracy) { m_accuracy = a_accuracy; }
+  void SetDreamEngine(DreamEngine a_engine) { m_engine = a_engine; }
+
+  // Threads Dream renders with; 0 (the default) means one per hardware thread
+  void SetThreadCount(int a_threads);
+
+  // On machines with several NUMA nodes, pin render workers to nodes and
+  // give each node its own copy of the weights.  On by default.
+  void SetNumaPlacement(bool a_enabled);
+
+  // Edge length of the square tiles Dream schedules across threads
+  void SetTileSize(int a_size) { m_tileSize = a_size; }
+  void SetTileSchedule(TileSchedule a_schedule) { m_schedule = a_schedule; }
+
+  // Before rendering a tile, bound its colours with interval arithmetic
+  // through the whole network, and fill it without evaluating any pixel
+  // when every channel provably rounds to one 8-bit value; otherwise split
+  // it and try the quarters.  The image is unchanged.  Off by default.
+  void SetIntervalCulling(bool a_enabled) { m_intervalCulling = a_enabled; }
+
   Pixel<float> Think(float x, float y, float z);
+
+  // Evaluates a_count points at once, treating the batch as a 16 x a_count
+  // activation matrix so that every layer is a matrix-matrix product
+  void ThinkBatch(const float* a_x, const float* a_y, const float* a_z, int a_count, Pixel<float>* a_out);
+
+  // Renders the image as square tiles, executed by the thread pool according
+  // to the tile schedule.  Every pixel is computed the same way wherever its tile or
+  // batch falls, so the image is bit-identical for any thread count.
   void Dream(int a_width, int a_height, float a_z, uint8_t* a_dest);
 
+  // Same, calling a_onTile from the worker thread as soon as each tile of
+  // a_dest is written, so consumers can stream the image out while it renders
+  typedef std::function<void(int a_x0, int a_y0, int a_x1, int a_y1)> TileCallback;
+  void Dream(int a_width, int a_height, float a_z, uint8_t* a_dest, const TileCallback& a_onTile);
+
+  // Renders coarse to fine and stops early: first the coarsest progressive
+  // pass below, which always completes, then full resolution tiles until
+  // they are all done, a_deadline passes or *a_cancel is set.  Tiles not
+  // reached keep the coarse blocks.  Returns the fraction of pixels
+  // rendered at full resolution, 1 for a complete image.
+  typedef std::chrono::steady_clock::time_point Deadline;
+  float Dream(int a_width, int a_height, float a_z, uint8_t* a_dest, Deadline a_deadline, const std::atomic<bool>* a_cancel = nullptr);
+
+  // Renders in passes over ever finer lattices: every 8th pixel in both
+  // directions, then every 4th, 2nd and finally all of them.  A pass only
+  // evaluates the pixels no coarser lattice has, and paints each over its
+  // stride-sized block, so after the pass a_dest holds a complete image at
+  // that resolution and a_onPass(stride) is called.  No pixel is evaluated
+  // twice and the final image is identical to Dream's.  Always runs on the
+  // batch engine, which produces the same pixels as the lane engine.
+  typedef std::function<void(int a_stride)> PassCallback;
+  void DreamProgressive(int a_width, int a_height, float a_z, uint8_t* a_dest, const PassCallback& a_onPass);
+
+  // Quadtree adaptive sampling: the network is evaluated at the corners of
+  // s_adaptiveCell sized cells, and a cell is split while any channel of its
+  // corners spans more than a_tolerance 8-bit steps.  Accepted cells are
+  // filled by bilinear interpolation of their corners.  Features smaller
+  // than a cell that don't touch its corners can be missed, even when the
+  // corners agree exactly, so a_tolerance 0 renders every pixel with Dream
+  // instead.  In brainAdaptive.cpp.
+  struct AdaptiveStats
+  {
+    int evaluations;  // Network evaluations made
+    int pixels;       // Pixels in the image
+  };
+  AdaptiveStats DreamAdaptive(int a_width, int a_height, float a_z, uint8_t* a_dest, int a_tolerance);
+
+  // Colours of the listed pixels (y * a_width + x) of the a_width x a_height
+  // image at a_z, their derivatives d(colour)/dz and, if a_bends isn't null,
+  // their second derivatives, all from one forward-mode pass with
+  // hyper-dual numbers.  The colours are the ones Dream's batch engine
+  // produces.  In brainDual.cpp.
+  void ThinkSlopes(int a_width, int a_height, float a_z, const int* a_pixels, int a_count,
+                   Pixel<float>* a_colors, Pixel<float>* a_slopes, Pixel<float>* a_bends = nullptr);
+
+  // Zeroes a freshly allocated, untouched a_dest with the tile deal of the
+  // current schedule, so the OS places each page on the NUMA node of the
+  // worker that will go on to render it.  Call it once on a new buffer,
+  // before the first Dream into it.
+  void FirstTouch(int a_width, int a_height, uint8_t* a_dest);
+
+  // A render that is advanced one tile at a time by whoever calls Next, on
+  // that caller's thread, instead of taking over the pool until it is done
+  class DreamJob;
+  DreamJob StartDream(int a_width, int a_height, float a_z, uint8_t* a_dest);
+
 protected:
   static const int s_networkSize = 16;   // Neurons per layer
   static const int s_nIn         = 3;    // Input layer size
   static const int s_nHidden     = 8;    // Hidden layers
   static const int s_nOut        = 3;    // Output layer size
+  static const int s_batchSize   = 256;  // Pixels per ThinkBatch call in Dream
+  static const int s_coarseBlock = 8;    // Lattice spacing of the first progressive pass
+  static const int s_adaptiveCell = 16;  // Root cell size of DreamAdaptive
+  static const int s_minCullSize  = 4;   // Interval culling doesn't split tiles below this
+  static const int s_dualBatch    = s_batchSize / 3;  // ThinkSlopes batches are about as many floats wide as Dream's
+
+  struct Layers
+  {
+    FixedMatrix<float, s_networkSize, s_nIn> input;
+    std::array<FixedMatrix<float, s_networkSize, s_networkSize>, s_nHidden> hidden;
+    FixedMatrix<float, s_nOut, s_networkSize> output;
+  };
+
+  // Per-worker scratch for the batch engine; only grows, so steady-state frames don't allocate
+  struct BatchScratch
+  {
+    Matrix<float> in, a, b, out;
+    std::vector<Pixel<float>> pixels;
+    Matrix<HyperDual<float>> dualA, dualB, dualOut;  // ThinkSlopes'
+    const Layers* layers = nullptr;  // Worker's NUMA node replica, or null for m_layers
+  };
+
+  const Layers& LayersFor(const BatchScratch& a_scratch) const { return a_scratch.layers ? *a_scratch.layers : m_layers; }
+
+  // The first layer is linear in (x, y, z), and on a grid x only depends on
+  // the column, y on the row and z on the frame.  Dream splits it into one
+  // term per input, so a pixel's pre-activation is (column + row) + depth,
+  // summed in the same order as the scalar kernel's dot product.
+  struct FirstLayerTerms
+  {
+    int width = 0, height = 0;
+    std::vector<float> columns;              // [s_networkSize x width]
+    std::vector<float> rows;                 // [s_networkSize x height]
+    std::array<float, s_networkSize> depth;
+  };
+  void ComputeTerms(int a_width, int a_height, float a_z, FirstLayerTerms& a_terms) const;
+
+  void ThinkBatch(const float* a_x, const float* a_y, const float* a_z, int a_count, Pixel<float>* a_out, BatchScratch& a_scratch);
+
+  // ThinkBatch from the first layer's pre-activations in a_scratch.a on
+  void ThinkFromFirstLayer(int a_count, Pixel<float>* a_out, BatchScratch& a_scratch);
+  static void ReserveBatch(int a_count, BatchScratch& a_scratch);
+
+  // Same with the first and second z derivatives carried along, from
+  // pre-activations in a_scratch.dualA
+  void ThinkDualFromFirstLayer(int a_count, Pixel<float>* a_colors, Pixel<float>* a_slopes, Pixel<float>* a_bends, BatchScratch& a_scratch);
+  ThreadPool& Pool();
+
+  struct Tile
+  {
+    int x0, y0, x1, y1;
+    int base;     // Index of the grid tile this was split from
+    double cost;  // Seconds: estimated before the frame, measured after
+  };
+
+  // Builds m_tiles for the next frame from the grid and the previous frame's costs
+  void PlanTiles(int a_width, int a_height, int a_threads);
+  void SplitTile(const Tile& a_tile, double a_target);
+
+  // Runs the planned tiles from m_terms, skipping those started after a_deadline or a_cancel.
+  // Returns the number of pixels rendered.
+  int DreamTiles(int a_width, int a_height, uint8_t* a_dest, const TileCallback& a_onTile,
+                 Deadline a_deadline, const std::atomic<bool>* a_cancel);
+  void DreamTile(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest, const Tile& a_tile, bool a_lanes, BatchScratch& a_scratch);
+  void DreamRect(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest,
+                 int a_x0, int a_y0, int a_x1, int a_y1, bool a_lanes, BatchScratch& a_scratch);
+  // Fills what interval culling can prove flat; false leaves the whole box to the engines
+  bool CullRect(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest,
+                int a_x0, int a_y0, int a_x1, int a_y1, bool a_lanes, BatchScratch& a_scratch);
+
+  // How many 8-bit levels [x0, x1) x [y0, y1) can provably span, over the
+  // widest channel; 0 means every pixel comes out as a_rgb.  In brainInterval.cpp.
+  int ColorSpread(const FirstLayerTerms& a_terms, int a_x0, int a_y0, int a_x1, int a_y1, const Layers& a_layers, uint8_t* a_rgb) const;
+
+  // One DreamProgressive pass from m_terms
+  void DreamPass(int a_width, int a_height, uint8_t* a_dest, int a_stride);
+
+  // Render the tile [x0, x1) x [y0, y1) of the image with either engine
+  void DreamBatch(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest,
+                  int a_x0, int a_y0, int a_x1, int a_y1, BatchScratch& a_scratch);
+  void DreamLanes(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest,
+                  int a_x0, int a_y0, int a_x1, int a_y1, const Layers& a_layers);  // In brainLanes.cpp
+
+  Layers m_layers;  // Fixed after construction; NUMA replicas are copied once
+
+  ActivationAccuracy m_accuracy = ActivationAccuracy::Exact;
+  DreamEngine m_engine = DreamEngine::Batch;
+
+  int m_threadCount = 0;
+  bool m_numa = true;
+  int m_tileSize = 32;
+  TileSchedule m_schedule = TileSchedule::Stealing;
+  bool m_intervalCulling = false;
+
+  std::vector<Tile> m_tiles;
+  std::vector<double> m_gridCosts;  // Previous frame's cost per grid tile, empty if unknown
+  int m_gridWidth = 0, m_gridHeight = 0, m_gridTileSize = 0;
+  std::unique_ptr<ThreadPool> m_pool;   // Created on first use
+  std::vector<BatchScratch> m_scratch;  // One per pool worker
+  std::vector<std::unique_ptr<Layers>> m_replicas;  // One per NUMA node when the pool spans several
+  FirstLayerTerms m_terms;              // Current frame's
+  std::vector<float> m_samples;         // DreamAdaptive's evaluated colours, 3 per pixel
+  std::vector<uint8_t> m_sampled;       // DreamAdaptive's per pixel flag: evaluated or queued
+};
+
+// Resumable render returned by BrainCpu::StartDream.  Each Next renders one
+// tile in raster order, so a caller can consume the image incrementally,
+// put the job aside and pick it up later, or round-robin many jobs over a
+// fixed set of threads.  A job owns its scratch and tile list and only
+// reads the network, so different jobs can run on different threads at
+// once, next to Dream; a single job must be advanced by one thread at a
+// time.  The BrainCpu has to outlive its jobs.
+class BrainCpu::DreamJob
+{
+public:
+  // Renders the next tile into the destination and reports its bounds.
+  // Returns false, leaving the bounds alone, once every tile is done.
+  bool Next(int& a_x0, int& a_y0, int& a_x1, int& a_y1);
+
+  bool Done() const { return m_next == m_tiles.size(); }
+
+  // Fraction of the image rendered so far, 1 for an empty image
+  float Progress() const
+  {
+    if (m_width <= 0 || m_height <= 0)
+      return 1.0f;
+    return (float)m_pixelsDone / ((float)m_width * m_height);
+  }
+
+private:
+  friend class BrainCpu;
+  DreamJob(BrainCpu& a_brain, int a_width, int a_height, float a_z, uint8_t* a_dest);
 
-  Matrix<float> m_layerInput;
-  std::array<Matrix<float>, s_nHidden> m_layersHidden;
-  Matrix<float> m_layerOutput;
+  BrainCpu* m_brain;
+  int m_width;
+  int m_height;
+  uint8_t* m_dest;
+  bool m_lanes;
+  FirstLayerTerms m_terms;
+  std::vector<Tile> m_tiles;
+  size_t m_next = 0;
+  int m_pixelsDone = 0;
+  BatchScratch m_scratch;
 };
@@ -0,0 +1,106 @@
+#include "brainCpu.h"
+#include <algorithm>
+
+// Bound by reference in std::min, so it needs a definition
+const int BrainCpu::s_dualBatch;
+
+// The activations run the accuracy tier's implementation on the values, as
+// Dream does, and the derivatives follow from the results: tanh' = 1 - t^2,
+// tanh'' = -2 t tanh', sigmoid' = s (1 - s) and sigmoid'' = (1 - 2 s) sigmoid'.
+template <bool Sigmoid>
+static void ActivateDual(HyperDual<float>* a_data, int a_count, ActivationAccuracy a_accuracy)
+{
+  const int chunk = 64;
+  float values[chunk];
+  for (int start = 0; start < a_count; start += chunk)
+  {
+    int count = std::min(chunk, a_count - start);
+    HyperDual<float>* data = a_data + start;
+    for (int i = 0; i < count; i++)
+      values[i] = data[i].v;
+    if (Sigmoid)
+      SigmoidArray(values, count, a_accuracy);
+    else
+      TanhArray(values, count, a_accuracy);
+    for (int i = 0; i < count; i++)
+    {
+      float f = values[i];
+      float slope = Sigmoid ? f * (1 - f) : 1 - f * f;
+      float bend = Sigmoid ? (1 - 2 * f) * slope : -2 * f * slope;
+      data[i] = data[i].Chain(f, slope, bend);
+    }
+  }
+}
+
+void BrainCpu::ThinkDualFromFirstLayer(int a_count, Pixel<float>* a_colors, Pixel<float>* a_slopes, Pixel<float>* a_bends, BatchScratch& a_scratch)
+{
+  Matrix<HyperDual<float>>& out = a_scratch.dualOut;
+  Matrix<HyperDual<float>>* act  = &a_scratch.dualA;
+  Matrix<HyperDual<float>>* next = &a_scratch.dualB;
+  const Layers& layers = LayersFor(a_scratch);
+
+  for (int n = 0; n < s_networkSize; n++)
+    ActivateDual<false>(&act->At(n, 0), a_count, m_accuracy);
+
+  for (auto& layer : layers.hidden)
+  {
+    MultiplyKernel(layer.m_storage.data(), s_networkSize, act->m_storage.data(), act->m_stride,
+                   next->m_storage.data(), next->m_stride, s_networkSize, s_networkSize, a_count);
+    for (int n = 0; n < s_networkSize; n++)
+      ActivateDual<false>(&next->At(n, 0), a_count, m_accuracy);
+    std::swap(act, next);
+  }
+
+  MultiplyKernel(layers.output.m_storage.data(), s_networkSize, act->m_storage.data(), act->m_stride,
+                 out.m_storage.data(), out.m_stride, s_nOut, s_networkSize, a_count);
+  for (int n = 0; n < s_nOut; n++)
+    ActivateDual<true>(&out.At(n, 0), a_count, m_accuracy);
+
+  for (int i = 0; i < a_count; i++)
+  {
+    a_colors[i] = Pixel<float> { out.At(0, i).v, out.At(1, i).v, out.At(2, i).v };
+    a_slopes[i] = Pixel<float> { out.At(0, i).d, out.At(1, i).d, out.At(2, i).d };
+    if (a_bends)
+      a_bends[i] = Pixel<float> { out.At(0, i).dd, out.At(1, i).dd, out.At(2, i).dd };
+  }
+}
+
+void BrainCpu::ThinkSlopes(int a_width, int a_height, float a_z, const int* a_pixels, int a_count,
+                           Pixel<float>* a_colors, Pixel<float>* a_slopes, Pixel<float>* a_bends)
+{
+  if (a_count <= 0)
+    return;
+
+  ThreadPool& pool = Pool();
+  ComputeTerms(a_width, a_height, a_z, m_terms);
+
+  // The first layer's pre-activation is (column + row) + depth, and only
+  // depth = w_z z depends on z, so every unit starts out with derivative w_z
+  // and second derivative 0
+  const float* weights = m_layers.input.m_storage.data();
+
+  int batches = (a_count + s_dualBatch - 1) / s_dualBatch;
+  pool.ParallelFor(batches, [&](int a_batch, int a_worker)
+  {
+    BatchScratch& scratch = m_scratch[a_worker];
+    if (scratch.dualA.m_height < s_dualBatch)
+    {
+      scratch.dualA   = Matrix<HyperDual<float>>(s_networkSize, s_dualBatch);
+      scratch.dualB   = Matrix<HyperDual<float>>(s_networkSize, s_dualBatch);
+      scratch.dualOut = Matrix<HyperDual<float>>(s_nOut, s_dualBatch);
+    }
+
+    const int* batch = a_pixels + a_batch * s_dualBatch;
+    int count = std::min(s_dualBatch, a_count - a_batch * s_dualBatch);
+    for (int n = 0; n < s_networkSize; n++)
+    {
+      HyperDual<float>* act = &scratch.dualA.At(n, 0);
+      float slope = weights[n * s_nIn + 2];
+      for (int i = 0; i < count; i++)
+        act[i] = HyperDual<float>((m_terms.columns[n * a_width + batch[i] % a_width] + m_terms.rows[n * a_height + batch[i] / a_width]) + m_terms.depth[n], slope);
+    }
+
+    int first = a_batch * s_dualBatch;
+    ThinkDualFromFirstLayer(count, a_colors + first, a_slopes + first, a_bends ? a_bends + first : nullptr, scratch);
+  });
+}
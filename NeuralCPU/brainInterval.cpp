@@ -0,0 +1,102 @@
+#include "brainCpu.h"
+#include <algorithm>
+#include <cmath>
+
+// Interval bounds on what Dream computes for a box of pixels.  Bounds are
+// kept in double and widened at every step by the most the float pipeline
+// can deviate: rounding in the first layer sums and the matrix products,
+// bounded by gamma(n) = n u / (1 - n u) times the sum of the magnitudes,
+// and the activation tier's error.  The enclosed values are the float
+// results themselves, so a box whose bounds round to one byte per channel
+// renders as that colour exactly.
+//
+// The bounds ignore how the units' inputs are correlated, so they grow by
+// roughly the sum of |w| per layer; with this network's depth they only
+// close in boxes where the early layers saturate.
+
+struct Interval
+{
+  double lo, hi;
+};
+
+static const double s_unitRoundoff = 1.0 / (1 << 24);
+
+static double Gamma(int a_n)
+{
+  return a_n * s_unitRoundoff / (1.0 - a_n * s_unitRoundoff);
+}
+
+static double Magnitude(const Interval& a_interval)
+{
+  return std::max(std::fabs(a_interval.lo), std::fabs(a_interval.hi));
+}
+
+// a_out = a_weights * a_in, widened by the float rounding of the products
+static void MultiplyInterval(const float* a_weights, int a_rows, int a_inner, const Interval* a_in, Interval* a_out)
+{
+  for (int j = 0; j < a_rows; j++)
+  {
+    double lo = 0.0, hi = 0.0, magnitude = 0.0;
+    for (int k = 0; k < a_inner; k++)
+    {
+      double w = a_weights[a_inner * j + k];
+      lo += w >= 0.0 ? w * a_in[k].lo : w * a_in[k].hi;
+      hi += w >= 0.0 ? w * a_in[k].hi : w * a_in[k].lo;
+      magnitude += std::fabs(w) * Magnitude(a_in[k]);
+    }
+    double error = Gamma(a_inner + 1) * magnitude + 1e-12;
+    a_out[j] = { lo - error, hi + error };
+  }
+}
+
+static void TanhInterval(Interval* a_data, int a_count, double a_error)
+{
+  for (int i = 0; i < a_count; i++)
+    a_data[i] = { std::max(-1.0, std::tanh(a_data[i].lo) - a_error), std::min(1.0, std::tanh(a_data[i].hi) + a_error) };
+}
+
+int BrainCpu::ColorSpread(const FirstLayerTerms& a_terms, int a_x0, int a_y0, int a_x1, int a_y1, const Layers& a_layers, uint8_t* a_rgb) const
+{
+  // The first layer's pre-activation is (column + row) + depth, each term a
+  // float from a_terms, so the box only needs their ranges over the tile
+  Interval act[s_networkSize], next[s_networkSize];
+  for (int n = 0; n < s_networkSize; n++)
+  {
+    const float* columns = &a_terms.columns[n * a_terms.width];
+    const float* rows = &a_terms.rows[n * a_terms.height];
+    auto column = std::minmax_element(columns + a_x0, columns + a_x1);
+    auto row = std::minmax_element(rows + a_y0, rows + a_y1);
+    double depth = a_terms.depth[n];
+    double lo = (double)*column.first + *row.first + depth;
+    double hi = (double)*column.second + *row.second + depth;
+    double magnitude = std::max(std::fabs(*column.first), std::fabs(*column.second)) +
+                       std::max(std::fabs(*row.first), std::fabs(*row.second)) + std::fabs(depth);
+    double error = Gamma(2) * magnitude + 1e-12;
+    act[n] = { lo - error, hi + error };
+  }
+
+  double activationError = ActivationErrorBound(m_accuracy) + 1e-12;
+  TanhInterval(act, s_networkSize, activationError);
+
+  for (const auto& layer : a_layers.hidden)
+  {
+    MultiplyInterval(layer.m_storage.data(), s_networkSize, s_networkSize, act, next);
+    TanhInterval(next, s_networkSize, activationError);
+    std::copy(next, next + s_networkSize, act);
+  }
+
+  Interval out[s_nOut];
+  MultiplyInterval(a_layers.output.m_storage.data(), s_nOut, s_networkSize, act, out);
+
+  // Dream stores (uint8_t)(v * 255.0), which is monotonic in v
+  int spread = 0;
+  for (int c = 0; c < s_nOut; c++)
+  {
+    double lo = std::max(0.0, 1.0 / (1.0 + std::exp(-out[c].lo)) - activationError);
+    double hi = std::min(1.0, 1.0 / (1.0 + std::exp(-out[c].hi)) + activationError);
+    int low = (int)(lo * 255.0), high = (int)(hi * 255.0);
+    spread = std::max(spread, high - low);
+    a_rgb[c] = (uint8_t)low;
+  }
+  return spread;
+}
@@ -0,0 +1,151 @@
+#include "brainCpu.h"
+#include <algorithm>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define SIMD_TARGET(x)
+#else
+#define SIMD_TARGET(x) __attribute__((target(x)))
+#endif
+
+// Lanes-across-pixels inference.  Each vector holds one neuron's value for
+// 8 (AVX2) or 16 (AVX-512) pixels, so a layer is a stream of FMAs of a
+// broadcast weight against the previous layer's vectors, with no horizontal
+// sums.  Products accumulate in the same order and with the same FMA
+// rounding as the matrix-matrix kernels, and activations go through the same
+// array functions, so the output matches the Batch engine.
+
+// Weights past the first layer, in the layout BrainCpu stores them.  The
+// first layer's pre-activations come from BrainCpu::FirstLayerTerms.
+struct LaneWeights
+{
+  const float* hidden;  // s_nHidden x [s_networkSize x s_networkSize], contiguous
+  const float* output;  // [s_nOut x s_networkSize]
+  int nNeurons, nHidden, nOut;
+  ActivationAccuracy accuracy;
+};
+
+static const int s_maxNeurons = 16;
+
+// a_act holds a_inner vectors of W lanes on entry; a_next gets a_rows vectors
+SIMD_TARGET("avx2,fma")
+static void LayerAvx2(const float* a_weights, int a_rows, int a_inner, const __m256* a_act, __m256* a_next)
+{
+  for (int j = 0; j < a_rows; j++)
+  {
+    __m256 acc = _mm256_setzero_ps();
+    for (int k = 0; k < a_inner; k++)
+      acc = _mm256_fmadd_ps(_mm256_set1_ps(a_weights[a_inner*j + k]), a_act[k], acc);
+    a_next[j] = acc;
+  }
+}
+
+// a_first is [nNeurons x 8] first layer pre-activations, a_rgb is [3 x 8] on exit
+SIMD_TARGET("avx2,fma")
+static void ThinkLanesAvx2(const LaneWeights& a_w, const float* a_first, float* a_rgb)
+{
+  alignas(32) __m256 act[s_maxNeurons];
+  alignas(32) __m256 next[s_maxNeurons];
+
+  for (int k = 0; k < a_w.nNeurons; k++)
+    next[k] = _mm256_loadu_ps(a_first + 8*k);
+  TanhArray((float*)next, 8 * a_w.nNeurons, a_w.accuracy);
+
+  for (int l = 0; l < a_w.nHidden; l++)
+  {
+    LayerAvx2(a_w.hidden + l * a_w.nNeurons * a_w.nNeurons, a_w.nNeurons, a_w.nNeurons, next, act);
+    TanhArray((float*)act, 8 * a_w.nNeurons, a_w.accuracy);
+    std::swap(act, next);
+  }
+
+  LayerAvx2(a_w.output, a_w.nOut, a_w.nNeurons, next, act);
+  SigmoidArray((float*)act, 8 * a_w.nOut, a_w.accuracy);
+
+  for (int c = 0; c < a_w.nOut; c++)
+    _mm256_storeu_ps(a_rgb + 8*c, act[c]);
+}
+
+#if NEURAL_AVX512
+SIMD_TARGET("avx512f")
+static void LayerAvx512(const float* a_weights, int a_rows, int a_inner, const __m512* a_act, __m512* a_next)
+{
+  for (int j = 0; j < a_rows; j++)
+  {
+    __m512 acc = _mm512_setzero_ps();
+    for (int k = 0; k < a_inner; k++)
+      acc = _mm512_fmadd_ps(_mm512_set1_ps(a_weights[a_inner*j + k]), a_act[k], acc);
+    a_next[j] = acc;
+  }
+}
+
+// a_first is [nNeurons x 16] first layer pre-activations, a_rgb is [3 x 16] on exit
+SIMD_TARGET("avx512f")
+static void ThinkLanesAvx512(const LaneWeights& a_w, const float* a_first, float* a_rgb)
+{
+  alignas(64) __m512 act[s_maxNeurons];
+  alignas(64) __m512 next[s_maxNeurons];
+
+  for (int k = 0; k < a_w.nNeurons; k++)
+    next[k] = _mm512_loadu_ps(a_first + 16*k);
+  TanhArray((float*)next, 16 * a_w.nNeurons, a_w.accuracy);
+
+  for (int l = 0; l < a_w.nHidden; l++)
+  {
+    LayerAvx512(a_w.hidden + l * a_w.nNeurons * a_w.nNeurons, a_w.nNeurons, a_w.nNeurons, next, act);
+    TanhArray((float*)act, 16 * a_w.nNeurons, a_w.accuracy);
+    std::swap(act, next);
+  }
+
+  LayerAvx512(a_w.output, a_w.nOut, a_w.nNeurons, next, act);
+  SigmoidArray((float*)act, 16 * a_w.nOut, a_w.accuracy);
+
+  for (int c = 0; c < a_w.nOut; c++)
+    _mm512_storeu_ps(a_rgb + 16*c, act[c]);
+}
+#endif
+
+void BrainCpu::DreamLanes(int a_width, int a_height, const FirstLayerTerms& a_terms, uint8_t* a_dest,
+                          int a_x0, int a_y0, int a_x1, int a_y1, const Layers& a_layers)
+{
+  static_assert(s_networkSize <= s_maxNeurons, "Lane kernels keep at most 16 neurons in registers");
+  static_assert(sizeof(a_layers.hidden) == sizeof(float) * s_nHidden * s_networkSize * s_networkSize,
+                "Hidden layers must be contiguous");
+
+  LaneWeights weights = { a_layers.hidden[0].m_storage.data(), a_layers.output.m_storage.data(),
+                          s_networkSize, s_nHidden, s_nOut, m_accuracy };
+
+  bool avx512 = GetSimdLevel() >= SimdLevel::Avx512;
+  const int lanes = avx512 ? 16 : 8;
+  alignas(64) float first[s_maxNeurons * 16];
+  alignas(64) float rgb[3 * 16];
+
+  for (int y = a_y0; y < a_y1; y++)
+  {
+    uint8_t* dest = a_dest + (y * a_width + a_x0) * 3;
+    for (int x0 = a_x0; x0 < a_x1; x0 += lanes)
+    {
+      // Lanes past the right edge of the tile repeat its last column and are discarded
+      int count = std::min(lanes, a_x1 - x0);
+      for (int n = 0; n < s_networkSize; n++)
+      {
+        const float* columns = &a_terms.columns[n * a_width];
+        float row = a_terms.rows[n * a_height + y];
+        for (int i = 0; i < lanes; i++)
+          first[n * lanes + i] = (columns[std::min(x0 + i, a_x1 - 1)] + row) + a_terms.depth[n];
+      }
+
+#if NEURAL_AVX512
+      if (avx512)
+        ThinkLanesAvx512(weights, first, rgb);
+      else
+#endif
+        ThinkLanesAvx2(weights, first, rgb);
+
+      for (int i = 0; i < count; i++)
+      {
+        *dest++ = (uint8_t)(rgb[i] * 255.0);
+        *dest++ = (uint8_t)(rgb[lanes + i] * 255.0);
+        *dest++ = (uint8_t)(rgb[2*lanes + i] * 255.0);
+      }
+    }
+  }
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include "matrixSimd.h"
+
+// Second-order forward-mode number: a value together with its first and
+// second derivatives with respect to one input (a hyper-dual number with
+// both infinitesimal parts seeded the same).  Linear maps act on all three
+// parts alike; a function f is applied by the chain rule as
+// (f(v), f'(v) d, f'(v) dd + f''(v) d^2).
+template <typename T>
+class HyperDual
+{
+public:
+  HyperDual(T a_v = 0, T a_d = 0, T a_dd = 0) : v(a_v), d(a_d), dd(a_dd) {}
+
+  // Applies f given f(v), f'(v) and f''(v)
+  HyperDual Chain(T a_f, T a_df, T a_ddf) const
+  {
+    return HyperDual(a_f, a_df * d, a_df * dd + a_ddf * d * d);
+  }
+
+  T v;   // Value
+  T d;   // First derivative
+  T dd;  // Second derivative
+};
+
+static_assert(sizeof(HyperDual<float>) == 3 * sizeof(float), "HyperDual<float> must be three packed floats");
+
+// Real weights times hyper-dual activations.  A row of them is a float row
+// of three times the length with the parts interleaved, and all three go
+// through the same linear map, so the float kernels run on it as is.
+inline void MultiplyKernel(const float* a_a, int a_lda, const HyperDual<float>* a_b, int a_ldb, HyperDual<float>* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  MultiplyFloat(a_a, a_lda, reinterpret_cast<const float*>(a_b), 3 * a_ldb,
+                reinterpret_cast<float*>(a_out), 3 * a_ldo, a_rows, a_inner, 3 * a_cols);
+}
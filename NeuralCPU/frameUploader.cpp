@@ -0,0 +1,154 @@
+#include "frameUploader.h"
+#include <cassert>
+
+FrameUploader::FrameUploader(GLuint a_texture, int a_width, int a_height, int a_slots, bool a_subRects) :
+  m_texture(a_texture), m_width(a_width), m_height(a_height), m_slotBytes((size_t)a_width * a_height * 3),
+  m_mapped(a_slots, nullptr), m_fences(a_slots, nullptr)
+{
+  // Storage is allocated once; every frame after that is a glTexSubImage2D
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  if (GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_storage)
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGB8, m_width, m_height);
+  else
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+  bool persistent = GLAD_GL_ARB_buffer_storage && (GLAD_GL_VERSION_3_2 || GLAD_GL_ARB_sync);
+  m_path = persistent ? UploadPath::Persistent : a_subRects ? UploadPath::Client : UploadPath::PboRing;
+
+  if (m_path == UploadPath::Persistent)
+  {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    m_buffers.resize(1);
+    glGenBuffers(1, m_buffers.data());
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[0]);
+    glBufferStorage(GL_PIXEL_UNPACK_BUFFER, m_slotBytes * a_slots, NULL, flags);
+    uint8_t* ring = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_slotBytes * a_slots, flags);
+    for (int i = 0; i < a_slots; i++)
+      m_mapped[i] = ring + m_slotBytes * i;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  else if (m_path == UploadPath::PboRing)
+  {
+    m_buffers.resize(a_slots);
+    glGenBuffers(a_slots, m_buffers.data());
+    for (GLuint buffer : m_buffers)
+    {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, m_slotBytes, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  else
+  {
+    m_client.assign(a_slots, std::vector<uint8_t>(m_slotBytes));
+    for (int i = 0; i < a_slots; i++)
+      m_mapped[i] = m_client[i].data();
+  }
+}
+
+FrameUploader::~FrameUploader()
+{
+  for (GLsync fence : m_fences)
+    if (fence)
+      glDeleteSync(fence);
+
+  for (size_t i = 0; i < m_buffers.size(); i++)
+  {
+    if (m_mapped[i] && m_path != UploadPath::Client)
+    {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[i]);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  if (!m_buffers.empty())
+    glDeleteBuffers((GLsizei)m_buffers.size(), m_buffers.data());
+}
+
+uint8_t* FrameUploader::Map(int a_slot)
+{
+  if (m_fences[a_slot])
+  {
+    while (glClientWaitSync(m_fences[a_slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+      ;
+    glDeleteSync(m_fences[a_slot]);
+    m_fences[a_slot] = nullptr;
+  }
+
+  if (!m_mapped[a_slot])
+  {
+    // Invalidating lets the driver hand out fresh memory instead of waiting
+    // for the previous upload from this buffer to finish
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[a_slot]);
+    m_mapped[a_slot] = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, m_slotBytes,
+                                                  GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  }
+  return m_mapped[a_slot];
+}
+
+bool FrameUploader::Ready(int a_slot)
+{
+  if (!m_fences[a_slot])
+    return true;
+  return glClientWaitSync(m_fences[a_slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0) != GL_TIMEOUT_EXPIRED;
+}
+
+void FrameUploader::Upload(int a_slot, int a_width, int a_height)
+{
+  if (m_path == UploadPath::PboRing)
+  {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[a_slot]);
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    m_mapped[a_slot] = nullptr;
+  }
+  CopyRect(a_slot, a_width, 0, 0, a_width, a_height);
+  Fence(a_slot);
+}
+
+void FrameUploader::UploadRect(int a_slot, int a_width, int a_x0, int a_y0, int a_x1, int a_y1)
+{
+  assert(m_path != UploadPath::PboRing);
+  CopyRect(a_slot, a_width, a_x0, a_y0, a_x1, a_y1);
+  Fence(a_slot);
+}
+
+void FrameUploader::CopyRect(int a_slot, int a_rowLength, int a_x0, int a_y0, int a_x1, int a_y1)
+{
+  // With a pixel unpack buffer bound the data pointer is an offset into it
+  const void* source;
+  if (m_path == UploadPath::Persistent)
+  {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[0]);
+    source = (const void*)(m_slotBytes * a_slot);
+  }
+  else if (m_path == UploadPath::PboRing)
+  {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffers[a_slot]);
+    source = NULL;
+  }
+  else
+    source = m_client[a_slot].data();
+
+  glBindTexture(GL_TEXTURE_2D, m_texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, a_rowLength);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, a_x0);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, a_y0);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, a_x0, a_y0, a_x1 - a_x0, a_y1 - a_y0, GL_RGB, GL_UNSIGNED_BYTE, source);
+  glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+  glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void FrameUploader::Fence(int a_slot)
+{
+  // Only the persistent mapping is written while the GPU may still be
+  // reading; client memory is copied before glTexSubImage2D returns and the
+  // PBO ring is orphaned on Map
+  if (m_path != UploadPath::Persistent)
+    return;
+  if (m_fences[a_slot])
+    glDeleteSync(m_fences[a_slot]);
+  m_fences[a_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
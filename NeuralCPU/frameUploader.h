@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+
+enum class UploadPath
+{
+  Client,      // Plain memory, copied by the driver during glTexSubImage2D
+  PboRing,     // One pixel buffer object per slot, mapped with invalidation each time it is rewritten
+  Persistent   // One GL_ARB_buffer_storage buffer mapped once for its whole life, fenced per slot
+};
+
+// Streams CPU rendered RGB8 frames into a texture with immutable storage.
+// Frames live in a ring of slots; Map hands out memory that Dream can write
+// into directly, so the upload needs no extra copy on the CPU side.  Frames
+// can be smaller than the texture and land in its top left corner.  All
+// calls must come from the thread owning the GL context, but the mapped
+// memory can be written from any thread.
+class FrameUploader
+{
+public:
+  // a_width x a_height is the largest frame.  a_subRects asks for UploadRect
+  // support, which a mapped PBO ring can't give, so without buffer storage
+  // that falls back to client memory.
+  FrameUploader(GLuint a_texture, int a_width, int a_height, int a_slots, bool a_subRects);
+  ~FrameUploader();
+
+  FrameUploader(const FrameUploader&) = delete;
+  FrameUploader& operator=(const FrameUploader&) = delete;
+
+  UploadPath Path() const { return m_path; }
+
+  // Memory to write slot a_slot's frame into, valid until the slot's next
+  // Upload.  Waits if the GPU is still reading the slot's previous frame.
+  uint8_t* Map(int a_slot);
+
+  // True once Map(a_slot) won't have to wait.
+  bool Ready(int a_slot);
+
+  // Copies the slot's whole a_width x a_height frame into the texture.  The
+  // slot has to be mapped again before it is rewritten.
+  void Upload(int a_slot, int a_width, int a_height);
+
+  // Copies the rectangle [a_x0, a_x1) x [a_y0, a_y1) of the slot's a_width
+  // wide frame and leaves the slot mapped.  Not available on the PboRing path.
+  void UploadRect(int a_slot, int a_width, int a_x0, int a_y0, int a_x1, int a_y1);
+
+private:
+  void CopyRect(int a_slot, int a_rowLength, int a_x0, int a_y0, int a_x1, int a_y1);
+  void Fence(int a_slot);
+
+  GLuint m_texture;
+  int m_width;
+  int m_height;
+  size_t m_slotBytes;
+  UploadPath m_path;
+
+  std::vector<GLuint> m_buffers;               // One per slot for PboRing, one shared for Persistent
+  std::vector<uint8_t*> m_mapped;              // Per slot, null while unmapped
+  std::vector<GLsync> m_fences;                // Persistent only, last copy out of each slot
+  std::vector<std::vector<uint8_t>> m_client;  // Client only
+};
@@ -1,8 +1,17 @@
 #include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
 #include <vector>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include "boundedQueue.h"
 #include "brainCpu.h"
+#include "frameUploader.h"
+#include "mpscQueue.h"
+#include "resolutionGovernor.h"
+#include "temporalExtrapolator.h"
 
 GLuint CompileShader(const char* a_src, GLuint a_type)
 {
@@ -50,24 +59,281 @@ GLuint LinkProgram(std::vector<GLuint> a_shaders)
   return program;
 }
 
+enum class LoopMode
+{
+  Serial,     // Dream, upload and present one after another
+  Pipelined,  // Dream the next frame on another thread while the current one is uploaded and presented
+  Streaming   // Pipelined, and tiles are uploaded as they finish rather than once per frame
+};
+
+static const int s_nFrames = 3;  // Image buffers in flight when pipelined
+
+// Streaming refines each frame from a lattice of every 8th pixel down,
+// rather than tile by tile.  Only worth it once a frame takes several
+// display intervals, otherwise every frame visibly starts out blurry.
+static const bool s_progressive = false;
+
+// Frames after the first are mostly extrapolated along z from each pixel's
+// d(colour)/dz, re-evaluating only pixels whose predicted error or drift
+// gets too large.  Approximate: the error is predicted, not checked, so the
+// odd pixel can be several levels off, and it only pays off when z moves
+// slowly enough that few pixels need evaluating each frame.
+static const bool s_extrapolate = false;
+
+// Hands uploaded slots back to the dreamer once the GPU has finished reading
+// them.  If every slot is waiting on the GPU the dreamer is starved, so the
+// oldest is waited for instead.
+void RecycleSlots(FrameUploader& a_uploader, std::deque<int>& a_pending, std::vector<uint8_t*>& a_frames, BoundedQueue<int>& a_freeFrames)
+{
+  while (!a_pending.empty() && ((int)a_pending.size() == s_nFrames || a_uploader.Ready(a_pending.front())))
+  {
+    int slot = a_pending.front();
+    a_pending.pop_front();
+    a_frames[slot] = a_uploader.Map(slot);
+    a_freeFrames.Push(slot);
+  }
+}
+
+// What the render loops draw to
+struct Screen
+{
+  GLFWwindow* window;
+  GLuint texture;
+  GLint uFrameSize;  // Frame size in texels, the rest of the texture is unused
+  int width;         // Texture size, the largest frame
+  int height;
+};
+
+// Draws the a_width x a_height frame in the texture's corner over the whole
+// window, letting the linear filter upscale it
+void Present(const Screen& a_screen, int a_width, int a_height)
+{
+  glUniform2f(a_screen.uFrameSize, (float)a_width, (float)a_height);
+  glClear(GL_COLOR_BUFFER_BIT);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glfwSwapBuffers(a_screen.window);
+}
+
+// Dreams one a_governor sized frame into a_dest, feeds back how long it took
+// and returns the size used.  Progressive and extrapolated frames report
+// each pass or frame as a tile covering the whole image.
+void DreamGoverned(BrainCpu& a_brain, ResolutionGovernor& a_governor, float a_z, uint8_t* a_dest,
+                   int& a_width, int& a_height, const BrainCpu::TileCallback& a_onTile = BrainCpu::TileCallback(),
+                   bool a_progressive = false, TemporalExtrapolator* a_extrapolator = nullptr)
+{
+  a_width  = a_governor.Width();
+  a_height = a_governor.Height();
+  int width = a_width, height = a_height;
+  auto start = std::chrono::steady_clock::now();
+  if (a_extrapolator)
+  {
+    a_extrapolator->Dream(a_brain, width, height, a_z, a_dest);
+    if (a_onTile)
+      a_onTile(0, 0, width, height);
+  }
+  else if (a_progressive)
+    a_brain.DreamProgressive(width, height, a_z, a_dest, [&](int)
+    {
+      if (a_onTile)
+        a_onTile(0, 0, width, height);
+    });
+  else
+    a_brain.Dream(a_width, a_height, a_z, a_dest, a_onTile);
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  a_governor.AddSample(elapsed.count());
+}
+
+void RunSerial(const Screen& a_screen, BrainCpu& a_brain, ResolutionGovernor& a_governor)
+{
+  // Two slots, so the GPU can read one frame while the next is dreamed
+  FrameUploader uploader(a_screen.texture, a_screen.width, a_screen.height, 2, false);
+  TemporalExtrapolator extrapolator;
+  int slot = 0;
+  float bias = -1.0;
+  while (!glfwWindowShouldClose(a_screen.window))
+  {
+    int width, height;
+    DreamGoverned(a_brain, a_governor, bias, uploader.Map(slot), width, height, BrainCpu::TileCallback(), false,
+                  s_extrapolate ? &extrapolator : nullptr);
+    bias += 0.01f;
+    uploader.Upload(slot, width, height);
+    slot ^= 1;
+
+    Present(a_screen, width, height);
+    glfwPollEvents();
+  }
+}
+
+void RunPipelined(const Screen& a_screen, BrainCpu& a_brain, ResolutionGovernor& a_governor)
+{
+  // Slots cycle free -> dreamer -> ready -> GL thread -> pending on the GPU -> free.
+  // The governor is only touched by the dreamer.
+  FrameUploader uploader(a_screen.texture, a_screen.width, a_screen.height, s_nFrames, false);
+  std::vector<uint8_t*> frames(s_nFrames);
+  std::vector<int> widths(s_nFrames), heights(s_nFrames);
+  std::deque<int> pending;
+  BoundedQueue<int> freeFrames(s_nFrames);
+  BoundedQueue<int> readyFrames(s_nFrames);
+  for (int i = 0; i < s_nFrames; i++)
+  {
+    frames[i] = uploader.Map(i);
+    freeFrames.Push(i);
+  }
+
+  std::thread dreamer([&]()
+  {
+    TemporalExtrapolator extrapolator;
+    float bias = -1.0;
+    int frame;
+    while (freeFrames.Pop(frame))
+    {
+      DreamGoverned(a_brain, a_governor, bias, frames[frame], widths[frame], heights[frame], BrainCpu::TileCallback(), false,
+                    s_extrapolate ? &extrapolator : nullptr);
+      bias += 0.01f;
+      if (!readyFrames.Push(frame))
+        break;
+    }
+  });
+
+  int frame;
+  while (!glfwWindowShouldClose(a_screen.window) && readyFrames.Pop(frame))
+  {
+    uploader.Upload(frame, widths[frame], heights[frame]);
+    pending.push_back(frame);
+
+    Present(a_screen, widths[frame], heights[frame]);
+    glfwPollEvents();
+    RecycleSlots(uploader, pending, frames, freeFrames);
+  }
+
+  freeFrames.Close();
+  readyFrames.Close();
+  dreamer.join();
+}
+
+void RunStreaming(const Screen& a_screen, BrainCpu& a_brain, ResolutionGovernor& a_governor)
+{
+  // A finished tile of one of the frame slots; x0 < 0 marks the end of a frame
+  struct TileUpdate
+  {
+    int frame;
+    int x0, y0, x1, y1;
+  };
+
+  FrameUploader uploader(a_screen.texture, a_screen.width, a_screen.height, s_nFrames, true);
+  std::vector<uint8_t*> frames(s_nFrames);
+  std::vector<int> widths(s_nFrames), heights(s_nFrames);
+  std::deque<int> pending;
+  BoundedQueue<int> freeFrames(s_nFrames);
+  for (int i = 0; i < s_nFrames; i++)
+  {
+    frames[i] = uploader.Map(i);
+    freeFrames.Push(i);
+  }
+  MpscQueue<TileUpdate> tiles(4096);
+  std::atomic<bool> quit(false);
+
+  // Render workers push tiles straight from their own threads
+  auto push = [&](const TileUpdate& a_update)
+  {
+    while (!tiles.TryPush(a_update) && !quit)
+      std::this_thread::yield();
+  };
+
+  std::thread dreamer([&]()
+  {
+    TemporalExtrapolator extrapolator;
+    float bias = -1.0;
+    int frame;
+    while (freeFrames.Pop(frame))
+    {
+      DreamGoverned(a_brain, a_governor, bias, frames[frame], widths[frame], heights[frame],
+                    [&](int a_x0, int a_y0, int a_x1, int a_y1)
+      {
+        push({ frame, a_x0, a_y0, a_x1, a_y1 });
+      }, s_progressive, s_extrapolate ? &extrapolator : nullptr);
+      bias += 0.01f;
+      push({ frame, -1, 0, 0, 0 });
+    }
+  });
+
+  // Shown frame size.  While a frame of a new size streams in, the texture
+  // holds a mix of both layouts, so nothing is presented until it is complete.
+  int width = 0, height = 0;
+  bool resizing = false;
+  while (!glfwWindowShouldClose(a_screen.window))
+  {
+    bool changed = false;
+    TileUpdate update;
+    while (tiles.TryPop(update))
+    {
+      changed = true;
+      if (update.x0 < 0)
+      {
+        // Every tile of this frame is uploaded
+        pending.push_back(update.frame);
+        resizing = false;
+        continue;
+      }
+      if (widths[update.frame] != width || heights[update.frame] != height)
+      {
+        width = widths[update.frame];
+        height = heights[update.frame];
+        resizing = true;
+      }
+      uploader.UploadRect(update.frame, width, update.x0, update.y0, update.x1, update.y1);
+    }
+
+    if (changed && !resizing)
+      Present(a_screen, width, height);
+    else
+      std::this_thread::sleep_for(std::chrono::microseconds(500));
+    glfwPollEvents();
+    RecycleSlots(uploader, pending, frames, freeFrames);
+  }
+
+  quit = true;
+  freeFrames.Close();
+  dreamer.join();
+}
+
 int main()
 {
-  static const int width  = 40;
-  static const int height = 40;
-  static const int scale  = 8;
+  // The internal resolution is scaled by the governor between 1/8 of the
+  // window size and the window size, to keep Dream within the budget
+  static const int width  = 320;
+  static const int height = 320;
+  static const double frameBudgetMs = 1000.0 / 60.0;
+  static const LoopMode loopMode = LoopMode::Streaming;
 
   BrainCpu brain;
-  uint8_t* image = new uint8_t[width*height * 3];
+  brain.SetTileSchedule(TileSchedule::CostModel);  // Consecutive frames cost about the same per tile
 
 #if 0
-  brain.Dream(width, height, 1.0, image);
+  std::vector<uint8_t> image(width*height * 3);
+  brain.Dream(width, height, 1.0, image.data());
   FILE* file;
   fopen_s(&file, "output.raw", "wb");
-  fwrite(image, 1, width*height * 3, file);
+  fwrite(image.data(), 1, width*height * 3, file);
   fclose(file);
   return 0;
 #endif
 
+#if 0
+  // Benchmark Dream across tile sizes
+  std::vector<uint8_t> image(width*height * 3);
+  for (int tileSize : { 8, 16, 32, 64 })
+  {
+    brain.SetTileSize(tileSize);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < 100; i++)
+      brain.Dream(width, height, 1.0, image.data());
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    printf("Tile size %2i: %.3f ms/frame\n", tileSize, elapsed.count() / 100);
+  }
+  return 0;
+#endif
+
   // Init OpenGL and make a window via GLFW
   if (!glfwInit())
     return -1;
@@ -77,7 +343,7 @@ int main()
   //glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
   //glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE);
 
-  GLFWwindow* window = glfwCreateWindow(width*scale, height*scale, "Hello World", NULL, NULL);
+  GLFWwindow* window = glfwCreateWindow(width, height, "Hello World", NULL, NULL);
   if (!window)
   {
     glfwTerminate();
@@ -106,7 +372,7 @@ int main()
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+  // Storage is allocated by the FrameUploader each render loop makes
   // Set up the quad geometry
   GLfloat quad[] = { 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f, 1.0f };
   GLuint quadVBO;
@@ -132,8 +398,11 @@ void main(void) {
 in vec2 pos;
 out vec4 oFragColor;
 uniform sampler2D uTexture;
+uniform vec2 uFrameSize;
 void main(void) {
-  oFragColor = vec4(texture2D(uTexture, pos).rgb, 1.0);
+  // Stay half a texel inside the frame so the filter never reads past its edge
+  vec2 texel = clamp(pos * uFrameSize, vec2(0.5), uFrameSize - 0.5);
+  oFragColor = vec4(texture2D(uTexture, texel / vec2(textureSize(uTexture, 0))).rgb, 1.0);
 })";
   error = glGetError();
   GLuint vertShader  = CompileShader(vertShaderSrc, GL_VERTEX_SHADER);
@@ -143,19 +412,16 @@ void main(void) {
   GLuint uTexture = glGetUniformLocation(renderProg, "uTexture");
   glUniform1i(uTexture, 0);
 
+  // Start at the lowest resolution and let the governor raise it
+  Screen screen = { window, texture, glGetUniformLocation(renderProg, "uFrameSize"), width, height };
+  ResolutionGovernor governor(width, height, frameBudgetMs, 12);
+
   // Main loop
-  float bias = -1.0;
-  while (!glfwWindowShouldClose(window))
+  switch (loopMode)
   {
-    brain.Dream(width, height, bias, image);
-    bias += 0.01f;
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-
-    glClear(GL_COLOR_BUFFER_BIT);
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+  case LoopMode::Serial:    RunSerial(screen, brain, governor);    break;
+  case LoopMode::Pipelined: RunPipelined(screen, brain, governor); break;
+  case LoopMode::Streaming: RunStreaming(screen, brain, governor); break;
   }
 
 
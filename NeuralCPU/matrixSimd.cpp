@@ -0,0 +1,448 @@
+#include "matrixSimd.h"
+#include "threadPool.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET(x)
+#else
+#define SIMD_TARGET(x) __attribute__((target(x)))
+#endif
+
+typedef void (*MultiplyFunc)(const float*, int, const float*, int, float*, int, int, int, int);
+
+void MultiplyFloatScalar(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  for (int x = 0; x < a_rows; x++)
+  {
+    for (int y = 0; y < a_cols; y++)
+    {
+      float dot = 0;
+      for (int k = 0; k < a_inner; k++)
+        dot += a_a[a_lda*x + k] * a_b[a_ldb*k + y];
+      a_out[a_ldo*x + y] = dot;
+    }
+  }
+}
+
+// Each kernel has two shapes: matrix-vector (cols == 1), where each output is a
+// contiguous dot product, and matrix-matrix, where we vectorize across the
+// output columns and broadcast the weights.  Tails are handled with scalar code.
+
+SIMD_TARGET("sse4.2")
+static void MultiplySse42(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  if (a_cols == 1 && a_ldb == 1)
+  {
+    for (int x = 0; x < a_rows; x++)
+    {
+      const float* row = a_a + a_lda*x;
+      __m128 acc = _mm_setzero_ps();
+      int k = 0;
+      for (; k + 4 <= a_inner; k += 4)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(row + k), _mm_loadu_ps(a_b + k)));
+      acc = _mm_hadd_ps(acc, acc);
+      acc = _mm_hadd_ps(acc, acc);
+      float dot = _mm_cvtss_f32(acc);
+      for (; k < a_inner; k++)
+        dot += row[k] * a_b[k];
+      a_out[a_ldo*x] = dot;
+    }
+    return;
+  }
+
+  for (int x = 0; x < a_rows; x++)
+  {
+    const float* row = a_a + a_lda*x;
+    int y = 0;
+    for (; y + 4 <= a_cols; y += 4)
+    {
+      __m128 acc = _mm_setzero_ps();
+      for (int k = 0; k < a_inner; k++)
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(row[k]), _mm_loadu_ps(a_b + a_ldb*k + y)));
+      _mm_storeu_ps(a_out + a_ldo*x + y, acc);
+    }
+    for (; y < a_cols; y++)
+    {
+      float dot = 0;
+      for (int k = 0; k < a_inner; k++)
+        dot += row[k] * a_b[a_ldb*k + y];
+      a_out[a_ldo*x + y] = dot;
+    }
+  }
+}
+
+SIMD_TARGET("avx2,fma")
+static void MultiplyAvx2(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  if (a_cols == 1 && a_ldb == 1)
+  {
+    for (int x = 0; x < a_rows; x++)
+    {
+      const float* row = a_a + a_lda*x;
+      __m256 acc = _mm256_setzero_ps();
+      int k = 0;
+      for (; k + 8 <= a_inner; k += 8)
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(row + k), _mm256_loadu_ps(a_b + k), acc);
+      __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+      sum = _mm_hadd_ps(sum, sum);
+      sum = _mm_hadd_ps(sum, sum);
+      float dot = _mm_cvtss_f32(sum);
+      for (; k < a_inner; k++)
+        dot += row[k] * a_b[k];
+      a_out[a_ldo*x] = dot;
+    }
+    return;
+  }
+
+  for (int x = 0; x < a_rows; x++)
+  {
+    const float* row = a_a + a_lda*x;
+    int y = 0;
+    for (; y + 8 <= a_cols; y += 8)
+    {
+      __m256 acc = _mm256_setzero_ps();
+      for (int k = 0; k < a_inner; k++)
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(row[k]), _mm256_loadu_ps(a_b + a_ldb*k + y), acc);
+      _mm256_storeu_ps(a_out + a_ldo*x + y, acc);
+    }
+    // Masked tail, so every column sees the same FMA rounding wherever it
+    // sits in the batch
+    if (y < a_cols)
+    {
+      static const int s_ramp[16] = { -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0 };
+      __m256i mask = _mm256_loadu_si256((const __m256i*)(s_ramp + 8 - (a_cols - y)));
+      __m256 acc = _mm256_setzero_ps();
+      for (int k = 0; k < a_inner; k++)
+        acc = _mm256_fmadd_ps(_mm256_set1_ps(row[k]), _mm256_maskload_ps(a_b + a_ldb*k + y, mask), acc);
+      _mm256_maskstore_ps(a_out + a_ldo*x + y, mask, acc);
+    }
+  }
+}
+
+#if NEURAL_AVX512
+SIMD_TARGET("avx512f")
+static void MultiplyAvx512(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  if (a_cols == 1 && a_ldb == 1)
+  {
+    for (int x = 0; x < a_rows; x++)
+    {
+      const float* row = a_a + a_lda*x;
+      __m512 acc = _mm512_setzero_ps();
+      int k = 0;
+      for (; k + 16 <= a_inner; k += 16)
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(row + k), _mm512_loadu_ps(a_b + k), acc);
+      if (k < a_inner)
+      {
+        __mmask16 mask = (__mmask16)((1u << (a_inner - k)) - 1);
+        acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, row + k), _mm512_maskz_loadu_ps(mask, a_b + k), acc);
+      }
+      // Spelled out, as _mm512_reduce_add_ps is missing from older MSVC
+      __m256 half = _mm256_add_ps(_mm512_castps512_ps256(acc), _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(acc), 1)));
+      __m128 sum = _mm_add_ps(_mm256_castps256_ps128(half), _mm256_extractf128_ps(half, 1));
+      sum = _mm_hadd_ps(sum, sum);
+      sum = _mm_hadd_ps(sum, sum);
+      a_out[a_ldo*x] = _mm_cvtss_f32(sum);
+    }
+    return;
+  }
+
+  for (int x = 0; x < a_rows; x++)
+  {
+    const float* row = a_a + a_lda*x;
+    for (int y = 0; y < a_cols; y += 16)
+    {
+      __mmask16 mask = a_cols - y >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (a_cols - y)) - 1);
+      __m512 acc = _mm512_setzero_ps();
+      for (int k = 0; k < a_inner; k++)
+        acc = _mm512_fmadd_ps(_mm512_set1_ps(row[k]), _mm512_maskz_loadu_ps(mask, a_b + a_ldb*k + y), acc);
+      _mm512_mask_storeu_ps(a_out + a_ldo*x + y, mask, acc);
+    }
+  }
+}
+#endif
+
+static void Cpuid(int a_leaf, int a_subleaf, unsigned a_regs[4])
+{
+#ifdef _MSC_VER
+  __cpuidex((int*)a_regs, a_leaf, a_subleaf);
+#else
+  __asm__ __volatile__("cpuid" : "=a"(a_regs[0]), "=b"(a_regs[1]), "=c"(a_regs[2]), "=d"(a_regs[3])
+                               : "a"(a_leaf), "c"(a_subleaf));
+#endif
+}
+
+static unsigned long long Xgetbv()
+{
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  unsigned lo, hi;
+  __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+SimdLevel DetectSimdLevel()
+{
+  static const SimdLevel s_detected = []()
+  {
+    unsigned regs[4];
+    Cpuid(0, 0, regs);
+    unsigned maxLeaf = regs[0];
+
+    Cpuid(1, 0, regs);
+    bool sse42   = (regs[2] & (1u << 20)) != 0;
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool fma     = (regs[2] & (1u << 12)) != 0;
+    if (!sse42)
+      return SimdLevel::Scalar;
+    if (!osxsave || maxLeaf < 7)
+      return SimdLevel::Sse42;
+
+    // Make sure the OS actually saves the wider registers
+    unsigned long long xcr0 = Xgetbv();
+    bool osAvx    = (xcr0 & 0x06) == 0x06;
+    bool osAvx512 = (xcr0 & 0xE6) == 0xE6;
+
+    Cpuid(7, 0, regs);
+    bool avx2    = (regs[1] & (1u << 5)) != 0;
+    bool avx512f = (regs[1] & (1u << 16)) != 0;
+
+    if (NEURAL_AVX512 && avx512f && osAvx512)
+      return SimdLevel::Avx512;
+    if (avx2 && fma && osAvx)
+      return SimdLevel::Avx2;
+    return SimdLevel::Sse42;
+  }();
+  return s_detected;
+}
+
+static MultiplyFunc KernelFor(SimdLevel a_level)
+{
+  switch (a_level)
+  {
+#if NEURAL_AVX512
+  case SimdLevel::Avx512: return MultiplyAvx512;
+#endif
+  case SimdLevel::Avx2:   return MultiplyAvx2;
+  case SimdLevel::Sse42:  return MultiplySse42;
+  default:                return MultiplyFloatScalar;
+  }
+}
+
+static SimdLevel    s_level    = DetectSimdLevel();
+static MultiplyFunc s_multiply = KernelFor(s_level);
+
+void SetSimdLevel(SimdLevel a_level)
+{
+  if (a_level > DetectSimdLevel())
+    a_level = DetectSimdLevel();
+  s_level    = a_level;
+  s_multiply = KernelFor(a_level);
+}
+
+SimdLevel GetSimdLevel()
+{
+  return s_level;
+}
+
+// Blocked GEMM.  B is packed into a KC x NC panel that stays in L2, and the
+// output is computed in MR x NR register tiles streaming one row of the panel
+// per k step.  Threads split the columns (or rows, for narrow outputs), so
+// each one packs only the part of B it uses and writes a disjoint output range.
+static const int s_mr = 4;    // Register tile rows
+static const int s_nr = 16;   // Register tile columns
+static const int s_kc = 256;  // Inner-dimension block (L1/L2)
+static const int s_nc = 512;  // Column block (L2)
+static const int s_blockedMinSize = 64;  // Rows and inner size before packing B pays off...
+static const long long s_blockedThreshold  = 64 * 64 * 64;    // ...and multiply-adds
+static const long long s_threadedThreshold = 256 * 256 * 64;  // ...and before threads pay off
+
+static int s_gemmThreads = 0;
+
+// Workers for threaded products, created on first use with s_gemmThreads.
+// Only one product at a time can use it; others run on their own thread.
+static std::unique_ptr<ThreadPool> s_gemmPool;
+static std::mutex s_gemmPoolMutex;
+
+void SetGemmThreads(int a_threads)
+{
+  std::lock_guard<std::mutex> lock(s_gemmPoolMutex);
+  s_gemmThreads = a_threads;
+  s_gemmPool.reset();
+}
+
+// out[MR x NR] += a[MR x kc] * panel[kc x NR], full tile
+SIMD_TARGET("avx2,fma")
+static void MicroKernelAvx2(const float* a_a, int a_lda, const float* a_panel, int a_ldp, float* a_out, int a_ldo, int a_kc)
+{
+  __m256 c[s_mr][2];
+  for (int r = 0; r < s_mr; r++)
+  {
+    c[r][0] = _mm256_loadu_ps(a_out + a_ldo*r);
+    c[r][1] = _mm256_loadu_ps(a_out + a_ldo*r + 8);
+  }
+  for (int k = 0; k < a_kc; k++)
+  {
+    __m256 b0 = _mm256_loadu_ps(a_panel + a_ldp*k);
+    __m256 b1 = _mm256_loadu_ps(a_panel + a_ldp*k + 8);
+    for (int r = 0; r < s_mr; r++)
+    {
+      __m256 a = _mm256_set1_ps(a_a[a_lda*r + k]);
+      c[r][0] = _mm256_fmadd_ps(a, b0, c[r][0]);
+      c[r][1] = _mm256_fmadd_ps(a, b1, c[r][1]);
+    }
+  }
+  for (int r = 0; r < s_mr; r++)
+  {
+    _mm256_storeu_ps(a_out + a_ldo*r, c[r][0]);
+    _mm256_storeu_ps(a_out + a_ldo*r + 8, c[r][1]);
+  }
+}
+
+// Same for a partial tile of a_mr x a_nr at an edge.  Lanes past a_nr are
+// masked off, and each element sees the same FMA sequence as in a full
+// tile, so a column's result doesn't depend on where it falls.
+SIMD_TARGET("avx2,fma")
+static void MicroKernelAvx2Edge(const float* a_a, int a_lda, const float* a_panel, int a_ldp, float* a_out, int a_ldo, int a_kc, int a_mr, int a_nr)
+{
+  static const int s_ramp[24] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0 };
+  __m256i mask0 = _mm256_loadu_si256((const __m256i*)(s_ramp + s_nr - std::min(a_nr, 8)));
+  __m256i mask1 = _mm256_loadu_si256((const __m256i*)(s_ramp + s_nr - std::max(a_nr - 8, 0)));
+  __m256 c[s_mr][2];
+  for (int r = 0; r < a_mr; r++)
+  {
+    c[r][0] = _mm256_maskload_ps(a_out + a_ldo*r, mask0);
+    c[r][1] = _mm256_maskload_ps(a_out + a_ldo*r + 8, mask1);
+  }
+  for (int k = 0; k < a_kc; k++)
+  {
+    __m256 b0 = _mm256_maskload_ps(a_panel + a_ldp*k, mask0);
+    __m256 b1 = _mm256_maskload_ps(a_panel + a_ldp*k + 8, mask1);
+    for (int r = 0; r < a_mr; r++)
+    {
+      __m256 a = _mm256_set1_ps(a_a[a_lda*r + k]);
+      c[r][0] = _mm256_fmadd_ps(a, b0, c[r][0]);
+      c[r][1] = _mm256_fmadd_ps(a, b1, c[r][1]);
+    }
+  }
+  for (int r = 0; r < a_mr; r++)
+  {
+    _mm256_maskstore_ps(a_out + a_ldo*r, mask0, c[r][0]);
+    _mm256_maskstore_ps(a_out + a_ldo*r + 8, mask1, c[r][1]);
+  }
+}
+
+// Same, when AVX2 is unavailable
+static void MicroKernelScalar(const float* a_a, int a_lda, const float* a_panel, int a_ldp, float* a_out, int a_ldo, int a_kc, int a_mr, int a_nr)
+{
+  for (int r = 0; r < a_mr; r++)
+  {
+    float c[s_nr];
+    for (int j = 0; j < a_nr; j++)
+      c[j] = a_out[a_ldo*r + j];
+    for (int k = 0; k < a_kc; k++)
+    {
+      float a = a_a[a_lda*r + k];
+      for (int j = 0; j < a_nr; j++)
+        c[j] += a * a_panel[a_ldp*k + j];
+    }
+    for (int j = 0; j < a_nr; j++)
+      a_out[a_ldo*r + j] = c[j];
+  }
+}
+
+// Multiply rows [row0, row1) x columns [col0, col1) of the output
+static void MultiplyBlockedRange(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_inner,
+                                 int a_row0, int a_row1, int a_col0, int a_col1, bool a_avx2)
+{
+  thread_local std::vector<float> panel;
+  panel.resize((size_t)s_kc * s_nc);
+
+  for (int x = a_row0; x < a_row1; x++)
+    std::fill(a_out + (size_t)a_ldo*x + a_col0, a_out + (size_t)a_ldo*x + a_col1, 0.0f);
+
+  for (int jc = a_col0; jc < a_col1; jc += s_nc)
+  {
+    int nc = std::min(s_nc, a_col1 - jc);
+    for (int pc = 0; pc < a_inner; pc += s_kc)
+    {
+      int kc = std::min(s_kc, a_inner - pc);
+
+      // Pack B[pc:pc+kc, jc:jc+nc] contiguously
+      for (int k = 0; k < kc; k++)
+        std::copy(a_b + (size_t)a_ldb*(pc + k) + jc, a_b + (size_t)a_ldb*(pc + k) + jc + nc, panel.data() + (size_t)nc*k);
+
+      for (int i = a_row0; i < a_row1; i += s_mr)
+      {
+        int mr = std::min(s_mr, a_row1 - i);
+        const float* a = a_a + (size_t)a_lda*i + pc;
+        for (int j = 0; j < nc; j += s_nr)
+        {
+          int nr = std::min(s_nr, nc - j);
+          float* out = a_out + (size_t)a_ldo*i + jc + j;
+          if (a_avx2 && mr == s_mr && nr == s_nr)
+            MicroKernelAvx2(a, a_lda, panel.data() + j, nc, out, a_ldo, kc);
+          else if (a_avx2)
+            MicroKernelAvx2Edge(a, a_lda, panel.data() + j, nc, out, a_ldo, kc, mr, nr);
+          else
+            MicroKernelScalar(a, a_lda, panel.data() + j, nc, out, a_ldo, kc, mr, nr);
+        }
+      }
+    }
+  }
+}
+
+void MultiplyFloatBlocked(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  bool avx2 = s_level >= SimdLevel::Avx2;
+
+  std::unique_lock<std::mutex> lock(s_gemmPoolMutex, std::defer_lock);
+  int threads = 1;
+  if ((long long)a_rows * a_inner * a_cols >= s_threadedThreshold && lock.try_lock())
+  {
+    if (!s_gemmPool)
+      s_gemmPool.reset(new ThreadPool(std::max(1, s_gemmThreads > 0 ? s_gemmThreads : (int)std::thread::hardware_concurrency())));
+    threads = s_gemmPool->Size();
+  }
+  // Prefer splitting columns; fall back to rows when the output is too narrow
+  bool splitCols = a_cols >= a_rows;
+  int extent = splitCols ? a_cols : a_rows;
+  int grain  = splitCols ? s_nr : s_mr;
+  threads = std::max(1, std::min(threads, extent / grain));
+
+  if (threads == 1)
+  {
+    MultiplyBlockedRange(a_a, a_lda, a_b, a_ldb, a_out, a_ldo, a_inner, 0, a_rows, 0, a_cols, avx2);
+    return;
+  }
+
+  // Chunk boundaries are multiples of the tile size, so only the last chunk has partial tiles
+  int chunk = (extent / grain + threads - 1) / threads * grain;
+  s_gemmPool->ParallelFor((extent + chunk - 1) / chunk, [&](int a_chunk, int)
+  {
+    int start = a_chunk * chunk;
+    int end = std::min(extent, start + chunk);
+    if (splitCols)
+      MultiplyBlockedRange(a_a, a_lda, a_b, a_ldb, a_out, a_ldo, a_inner, 0, a_rows, start, end, avx2);
+    else
+      MultiplyBlockedRange(a_a, a_lda, a_b, a_ldb, a_out, a_ldo, a_inner, start, end, 0, a_cols, avx2);
+  });
+}
+
+void MultiplyFloat(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols)
+{
+  // Small weight matrices (e.g. 16x16 times a wide batch) stay on the plain
+  // kernels, which read B straight from cache without packing it
+  if (a_rows >= s_blockedMinSize && a_inner >= s_blockedMinSize && a_cols > 1 &&
+      (long long)a_rows * a_inner * a_cols >= s_blockedThreshold)
+    MultiplyFloatBlocked(a_a, a_lda, a_b, a_ldb, a_out, a_ldo, a_rows, a_inner, a_cols);
+  else
+    s_multiply(a_a, a_lda, a_b, a_ldb, a_out, a_ldo, a_rows, a_inner, a_cols);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+// AVX-512 intrinsics need VS2017 15.3 (_MSC_VER 1911) or later; older
+// compilers build without the AVX-512 kernels and never detect the level
+#if !defined(_MSC_VER) || _MSC_VER >= 1911
+#define NEURAL_AVX512 1
+#else
+#define NEURAL_AVX512 0
+#endif
+
+// Instruction sets the float matrix kernels can be dispatched to
+enum class SimdLevel
+{
+  Scalar,
+  Sse42,
+  Avx2,
+  Avx512
+};
+
+// Best level supported by this CPU and OS, determined once via CPUID
+SimdLevel DetectSimdLevel();
+
+// Override the kernel selection (e.g. to compare against the scalar reference).
+// Levels above what DetectSimdLevel() reports are clamped down.
+void SetSimdLevel(SimdLevel a_level);
+SimdLevel GetSimdLevel();
+
+// Threads used by the blocked GEMM path for large products; 0 means one per hardware thread
+void SetGemmThreads(int a_threads);
+
+// out[rows x cols] = a[rows x inner] * b[inner x cols], all row-major.
+// a_lda, a_ldb and a_ldo are the row pitches in elements.
+void MultiplyFloat(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols);
+
+// Scalar reference version of the above, always available
+void MultiplyFloatScalar(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols);
+
+// Cache-blocked version used automatically by MultiplyFloat for large
+// products with at least 64 rows and 64 inner elements
+void MultiplyFloatBlocked(const float* a_a, int a_lda, const float* a_b, int a_ldb, float* a_out, int a_ldo, int a_rows, int a_inner, int a_cols);
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free queue for many producers and one consumer, after Dmitry
+// Vyukov's bounded MPMC design.  Each cell carries a sequence number that
+// tells producers and the consumer whose turn it is, so neither side ever
+// takes a lock.  Pushing releases the item, so whatever a producer wrote
+// before pushing is visible to the consumer once it pops it.
+template <typename T>
+class MpscQueue
+{
+public:
+  // a_capacity is rounded up to a power of two
+  explicit MpscQueue(size_t a_capacity)
+  {
+    size_t capacity = 2;
+    while (capacity < a_capacity)
+      capacity *= 2;
+    m_cells.reset(new Cell[capacity]);
+    m_mask = capacity - 1;
+    for (size_t i = 0; i < capacity; i++)
+      m_cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // Returns false if the queue is full
+  bool TryPush(const T& a_item)
+  {
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+    for (;;)
+    {
+      cell = &m_cells[pos & m_mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+      if (diff == 0)
+      {
+        if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0)
+        return false;
+      else
+        pos = m_enqueuePos.load(std::memory_order_relaxed);
+    }
+    cell->item = a_item;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Returns false if the queue is empty.  Only one thread may pop.
+  bool TryPop(T& a_item)
+  {
+    size_t pos = m_dequeuePos;
+    Cell* cell = &m_cells[pos & m_mask];
+    if (cell->sequence.load(std::memory_order_acquire) != pos + 1)
+      return false;
+    a_item = cell->item;
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+    m_dequeuePos = pos + 1;
+    return true;
+  }
+
+private:
+  struct Cell
+  {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  std::unique_ptr<Cell[]> m_cells;
+  size_t m_mask;
+  char m_pad0[64];
+  std::atomic<size_t> m_enqueuePos{0};
+  char m_pad1[64];
+  size_t m_dequeuePos = 0;
+};
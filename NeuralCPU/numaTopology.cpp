@@ -0,0 +1,102 @@
+#include "numaTopology.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__linux__)
+// Parses a sysfs list such as "0-3,8-11"
+static std::vector<int> ParseList(const std::string& a_list)
+{
+  std::vector<int> cpus;
+  std::stringstream stream(a_list);
+  std::string range;
+  while (std::getline(stream, range, ','))
+  {
+    int first, last;
+    char dash;
+    std::stringstream parts(range);
+    if (!(parts >> first))
+      continue;
+    if (!(parts >> dash >> last))
+      last = first;
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+#endif
+
+std::vector<NumaNode> GetNumaNodes()
+{
+  std::vector<NumaNode> nodes;
+
+#ifdef _WIN32
+  ULONG highest = 0;
+  if (GetNumaHighestNodeNumber(&highest))
+  {
+    for (USHORT id = 0; id <= highest; id++)
+    {
+      GROUP_AFFINITY affinity;
+      if (!GetNumaNodeProcessorMaskEx(id, &affinity) || !affinity.Mask)
+        continue;
+      NumaNode node = { id, {} };
+      for (int bit = 0; bit < 64; bit++)
+        if (affinity.Mask & (KAFFINITY(1) << bit))
+          node.cpus.push_back(affinity.Group * 64 + bit);
+      nodes.push_back(node);
+    }
+  }
+#elif defined(__linux__)
+  std::ifstream online("/sys/devices/system/node/online");
+  std::string ids;
+  if (online && std::getline(online, ids))
+  {
+    for (int id : ParseList(ids))
+    {
+      std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+      std::string list;
+      if (!file || !std::getline(file, list))
+        continue;
+      NumaNode node = { id, ParseList(list) };
+      if (!node.cpus.empty())
+        nodes.push_back(node);
+    }
+  }
+#endif
+
+  if (nodes.empty())
+    nodes.push_back(NumaNode { 0, {} });
+  return nodes;
+}
+
+bool PinThreadToNode(const NumaNode& a_node)
+{
+  if (a_node.cpus.empty())
+    return false;
+
+#ifdef _WIN32
+  // A thread can only be bound to one processor group; nodes don't span groups
+  GROUP_AFFINITY affinity = {};
+  affinity.Group = (WORD)(a_node.cpus[0] / 64);
+  for (int cpu : a_node.cpus)
+    if (cpu / 64 == affinity.Group)
+      affinity.Mask |= KAFFINITY(1) << (cpu % 64);
+  return SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL) != 0;
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : a_node.cpus)
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  return false;
+#endif
+}
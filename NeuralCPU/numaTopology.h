@@ -0,0 +1,15 @@
+#pragma once
+#include <vector>
+
+struct NumaNode
+{
+  int id;
+  std::vector<int> cpus;  // Logical processors; on Windows numbered group * 64 + index in the group
+};
+
+// The machine's NUMA nodes that have processors.  Without NUMA information
+// from the OS this is a single node with an empty processor list.
+std::vector<NumaNode> GetNumaNodes();
+
+// Restricts the calling thread to a_node's processors; false if it couldn't
+bool PinThreadToNode(const NumaNode& a_node);
@@ -0,0 +1,51 @@
+#include "resolutionGovernor.h"
+#include <algorithm>
+#include <cmath>
+
+const double ResolutionGovernor::s_smoothing  = 0.25;
+const double ResolutionGovernor::s_upHeadroom = 0.85;
+const int    ResolutionGovernor::s_minSize;  // Bound by reference in std::max
+
+ResolutionGovernor::ResolutionGovernor(int a_maxWidth, int a_maxHeight, double a_budgetMs, int a_startLevel) :
+  m_maxWidth(a_maxWidth), m_maxHeight(a_maxHeight), m_budgetMs(a_budgetMs)
+{
+  SetLevel(a_startLevel);
+}
+
+void ResolutionGovernor::AddSample(double a_dreamMs)
+{
+  m_smoothedMs = m_smoothedMs == 0.0 ? a_dreamMs : m_smoothedMs + s_smoothing * (a_dreamMs - m_smoothedMs);
+
+  // Dream time is close to proportional to the pixel count
+  bool over = m_smoothedMs > m_budgetMs && m_level < s_levels - 1;
+  bool under = m_level > 0 && m_smoothedMs * Pixels(m_level - 1) / Pixels(m_level) < m_budgetMs * s_upHeadroom;
+  m_overCount  = over  ? m_overCount + 1  : 0;
+  m_underCount = under ? m_underCount + 1 : 0;
+
+  if (m_overCount >= s_patience)
+    SetLevel(m_level + 1);
+  else if (m_underCount >= s_patience)
+    SetLevel(m_level - 1);
+}
+
+void ResolutionGovernor::SetLevel(int a_level)
+{
+  int level = std::max(0, std::min(s_levels - 1, a_level));
+  double scale = std::pow(2.0, -0.25 * level);
+  m_width  = std::max(s_minSize, (int)std::lround(m_maxWidth * scale));
+  m_height = std::max(s_minSize, (int)std::lround(m_maxHeight * scale));
+  m_width  = std::min(m_width, m_maxWidth);
+  m_height = std::min(m_height, m_maxHeight);
+
+  // Rescale the running average to the new pixel count rather than forget it
+  if (m_smoothedMs != 0.0)
+    m_smoothedMs *= Pixels(level) / Pixels(m_level);
+  m_level = level;
+  m_overCount = 0;
+  m_underCount = 0;
+}
+
+double ResolutionGovernor::Pixels(int a_level) const
+{
+  return std::pow(2.0, -0.5 * a_level);
+}
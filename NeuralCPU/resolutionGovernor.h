@@ -0,0 +1,44 @@
+#pragma once
+
+// Picks the internal render resolution from measured Dream times so frames
+// stay within a time budget.  Resolutions step down from the maximum by a
+// factor of 2^(1/4) per side, so each step halves the pixel count every two
+// steps.  A step is only taken after the smoothed time has asked for it for
+// several frames in a row, and stepping up needs the larger resolution to
+// be predicted to fit with room to spare, so it doesn't oscillate.
+class ResolutionGovernor
+{
+public:
+  // Starts at a_startLevel steps below a_maxWidth x a_maxHeight
+  ResolutionGovernor(int a_maxWidth, int a_maxHeight, double a_budgetMs, int a_startLevel = 0);
+
+  void SetBudget(double a_budgetMs) { m_budgetMs = a_budgetMs; }
+  double Budget() const { return m_budgetMs; }
+
+  int Width() const { return m_width; }
+  int Height() const { return m_height; }
+
+  // Feeds the time the last frame at Width() x Height() took to dream,
+  // possibly changing the resolution for the next one.
+  void AddSample(double a_dreamMs);
+
+private:
+  void SetLevel(int a_level);
+  double Pixels(int a_level) const;
+
+  static const int    s_levels   = 13;    // Down to 1/8 of the maximum per side
+  static const int    s_patience = 8;     // Frames a step has to be asked for in a row
+  static const double s_smoothing;        // Weight of the newest sample
+  static const double s_upHeadroom;       // Fraction of the budget the next step up has to fit in
+  static const int    s_minSize  = 8;
+
+  int m_maxWidth;
+  int m_maxHeight;
+  double m_budgetMs;
+  int m_level = 0;
+  int m_width = 0;
+  int m_height = 0;
+  double m_smoothedMs = 0.0;  // 0 until the first sample at this level
+  int m_overCount = 0;
+  int m_underCount = 0;
+};
@@ -0,0 +1,98 @@
+#include "temporalExtrapolator.h"
+#include <algorithm>
+#include <cmath>
+
+static uint8_t ToByte(float a_value)
+{
+  return (uint8_t)(std::min(1.0f, std::max(0.0f, a_value)) * 255.0);
+}
+
+TemporalExtrapolator::TemporalExtrapolator(float a_tolerance, float a_maxDrift, int a_maxAge) :
+  m_tolerance(a_tolerance), m_maxDrift(a_maxDrift), m_maxAge(a_maxAge)
+{
+}
+
+int TemporalExtrapolator::Dream(BrainCpu& a_brain, int a_width, int a_height, float a_z, uint8_t* a_dest)
+{
+  if (a_width != m_width || a_height != m_height)
+  {
+    m_width = a_width;
+    m_height = a_height;
+    m_samples.assign(a_width * a_height, Sample { {}, {}, 0.0f, 0.0f, -1 });
+    m_speeds.assign(a_width * a_height, 0.0f);
+  }
+
+  // Draw what can be extrapolated, collect the rest
+  m_stale.clear();
+  for (int i = 0; i < a_width * a_height; i++)
+  {
+    Sample& sample = m_samples[i];
+    float dz = a_z - sample.z;
+    if (sample.age < 0 || sample.age + 1 >= m_maxAge || sample.curvature * dz * dz > m_tolerance)
+    {
+      m_stale.push_back(i);
+      continue;
+    }
+
+    // Edges move across the image as z changes, and a pixel's own slope
+    // only sees one once it has arrived, so drift goes by the steepest
+    // neighbour's
+    int x = i % a_width, y = i / a_width;
+    float speed = 0.0f;
+    for (int ny = std::max(0, y - 1); ny <= std::min(a_height - 1, y + 1); ny++)
+      for (int nx = std::max(0, x - 1); nx <= std::min(a_width - 1, x + 1); nx++)
+        speed = std::max(speed, m_speeds[ny * a_width + nx]);
+    if (speed * std::fabs(dz) > m_maxDrift)
+    {
+      m_stale.push_back(i);
+      continue;
+    }
+
+    for (int c = 0; c < 3; c++)
+      a_dest[i * 3 + c] = ToByte(sample.color.m_storage[c] + sample.slope.m_storage[c] * dz);
+    sample.age++;
+  }
+
+  int count = (int)m_stale.size();
+  m_colors.resize(count);
+  m_slopes.resize(count);
+  m_bends.resize(count);
+  a_brain.ThinkSlopes(a_width, a_height, a_z, m_stale.data(), count, m_colors.data(), m_slopes.data(), m_bends.data());
+
+  for (int k = 0; k < count; k++)
+  {
+    int i = m_stale[k];
+    Sample& sample = m_samples[i];
+    const Pixel<float>& color = m_colors[k];
+
+    // The curvature, error ~ curvature dz^2, predicts when to come back.
+    // The second derivative gives it before the pixel is ever trusted, and
+    // how far off the last extrapolation would have been raises it where
+    // the colour bends faster further out
+    float curvature = 0.0f;
+    for (int c = 0; c < 3; c++)
+      curvature = std::max(curvature, 0.5f * std::fabs(m_bends[k].m_storage[c]) * 255.0f);
+    float dz = a_z - sample.z;
+    if (sample.age >= 0 && dz != 0.0f)
+    {
+      float error = 0.0f;
+      for (int c = 0; c < 3; c++)
+        error = std::max(error, std::fabs(sample.color.m_storage[c] + sample.slope.m_storage[c] * dz - color.m_storage[c]) * 255.0f);
+      curvature = std::max(curvature, error / (dz * dz));
+    }
+    sample.curvature = curvature;
+
+    sample.color = color;
+    sample.slope = m_slopes[k];
+    sample.z = a_z;
+    sample.age = 0;
+    float speed = 0.0f;
+    for (int c = 0; c < 3; c++)
+      speed = std::max(speed, std::fabs(sample.slope.m_storage[c]) * 255.0f);
+    m_speeds[i] = speed;
+    for (int c = 0; c < 3; c++)
+      a_dest[i * 3 + c] = ToByte(color.m_storage[c]);
+  }
+
+  return count;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "brainCpu.h"
+
+// Animates along z by extrapolating pixels instead of dreaming every frame.
+// Each evaluated pixel keeps its colour and d(colour)/dz from
+// BrainCpu::ThinkSlopes, and later frames draw it as colour + slope * dz.
+// A pixel is evaluated again once the predicted error, from a per-pixel
+// curvature taken from the second derivative ThinkSlopes returns alongside
+// the slope and from how far off its last extrapolation was, exceeds the
+// tolerance, once the extrapolated change since the evaluation exceeds the
+// drift limit, or once it is too many frames old.  Tolerance and drift are
+// in 8-bit levels.  A new frame size starts over with every pixel.
+class TemporalExtrapolator
+{
+public:
+  TemporalExtrapolator(float a_tolerance = 1.0f, float a_maxDrift = 16.0f, int a_maxAge = 60);
+
+  // Writes the a_width x a_height frame at a_z to a_dest, which needn't
+  // hold the previous frame.  Returns the number of pixels evaluated.
+  int Dream(BrainCpu& a_brain, int a_width, int a_height, float a_z, uint8_t* a_dest);
+
+private:
+  // State at a pixel's last evaluation
+  struct Sample
+  {
+    Pixel<float> color;
+    Pixel<float> slope;
+    float z;
+    float curvature;  // Levels of error per dz^2
+    int age;          // Frames since the evaluation
+  };
+
+  float m_tolerance;
+  float m_maxDrift;
+  int m_maxAge;
+  int m_width = 0;
+  int m_height = 0;
+  std::vector<Sample> m_samples;
+  std::vector<float> m_speeds;  // Largest |slope| over the channels, in levels per unit of z
+  std::vector<int> m_stale;  // Pixels to evaluate this frame
+  std::vector<Pixel<float>> m_colors, m_slopes, m_bends;
+};
@@ -0,0 +1,157 @@
+#include "threadPool.h"
+
+ThreadPool::ThreadPool(int a_threads, bool a_pinToNodes) :
+  m_nextJob(0), m_remaining(0)
+{
+  if (a_pinToNodes)
+    m_nodes = GetNumaNodes();
+  m_pinned = m_nodes.size() > 1;
+  if (!m_pinned)
+    m_nodes.assign(1, NumaNode { 0, {} });
+
+  m_nodeWorkers.resize(m_nodes.size());
+  for (int i = 0; i < a_threads; i++)
+  {
+    int node = (int)((long long)i * m_nodes.size() / a_threads);
+    m_workerNodes.push_back(node);
+    m_nodeWorkers[node].push_back(i);
+    m_queues.emplace_back(new WorkQueue());
+  }
+  for (int i = 0; i < a_threads - 1; i++)
+    m_threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_quit = true;
+  }
+  m_wake.notify_all();
+  for (auto& thread : m_threads)
+    thread.join();
+}
+
+void ThreadPool::Launch(int a_jobs, JobFunc a_func, void* a_context, Mode a_mode)
+{
+  if (m_threads.empty())
+  {
+    for (int job = 0; job < a_jobs; job++)
+      a_func(a_context, job, 0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_func = a_func;
+    m_context = a_context;
+    m_jobs = a_jobs;
+    m_nextJob = 0;
+    m_mode = a_mode;
+    if (a_mode == Mode::Stealing)
+    {
+      int workers = Size();
+      for (int w = 0; w < workers; w++)
+      {
+        std::lock_guard<std::mutex> queueLock(m_queues[w]->mutex);
+        m_queues[w]->front = (int)((long long)a_jobs * w / workers);
+        m_queues[w]->back  = (int)((long long)a_jobs * (w + 1) / workers);
+      }
+      m_remaining = a_jobs;
+    }
+    m_busy = (int)m_threads.size();
+    m_generation++;
+  }
+  m_wake.notify_all();
+
+  RunJobs(Size() - 1);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [&]() { return m_busy == 0; });
+  m_func = nullptr;
+  m_context = nullptr;
+}
+
+void ThreadPool::RunJobs(int a_worker)
+{
+  if (m_mode == Mode::Stealing)
+  {
+    RunJobsStealing(a_worker);
+    return;
+  }
+  if (m_mode == Mode::EachWorker)
+  {
+    m_func(m_context, a_worker, a_worker);
+    return;
+  }
+
+  for (int job = m_nextJob++; job < m_jobs; job = m_nextJob++)
+    m_func(m_context, job, a_worker);
+}
+
+void ThreadPool::RunJobsStealing(int a_worker)
+{
+  WorkQueue& own = *m_queues[a_worker];
+  int workers = Size();
+  uint32_t rng = 2654435761u * (uint32_t)(a_worker + 1) + (uint32_t)m_generation;
+  unsigned attempt = 0;
+
+  while (m_remaining > 0)
+  {
+    int job = -1;
+    {
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (own.front < own.back)
+        job = own.front++;
+    }
+
+    if (job < 0)
+    {
+      // xorshift32 to pick a victim, alternating between the own node and anywhere
+      rng ^= rng << 13;
+      rng ^= rng >> 17;
+      rng ^= rng << 5;
+      const std::vector<int>& local = m_nodeWorkers[m_workerNodes[a_worker]];
+      bool nearby = m_pinned && (attempt++ & 1) == 0;
+      WorkQueue& victim = *m_queues[nearby ? local[rng % local.size()] : rng % workers];
+      if (&victim != &own)
+      {
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.front < victim.back)
+          job = --victim.back;
+      }
+    }
+
+    if (job >= 0)
+    {
+      m_func(m_context, job, a_worker);
+      m_remaining--;
+    }
+    else
+      std::this_thread::yield();
+  }
+}
+
+void ThreadPool::WorkerLoop(int a_worker)
+{
+  if (m_pinned)
+    PinThreadToNode(m_nodes[m_workerNodes[a_worker]]);
+
+  uint64_t seen = 0;
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [&]() { return m_quit || m_generation != seen; });
+      if (m_quit)
+        return;
+      seen = m_generation;
+    }
+
+    RunJobs(a_worker);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_busy == 0)
+      m_done.notify_one();
+  }
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "numaTopology.h"
+
+// Persistent set of worker threads for data-parallel loops.  The thread
+// calling ParallelFor takes part as the last worker, so a pool of N runs
+// N-1 background threads.
+//
+// With a_pinToNodes on a machine with several NUMA nodes, workers are split
+// into contiguous runs, one per node, and each background thread is pinned
+// to its node.  The calling thread is left alone but counted in the last run.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(int a_threads, bool a_pinToNodes = false);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int Size() const { return (int)m_threads.size() + 1; }
+
+  // Number of nodes workers are spread over, and the one a worker is on
+  int Nodes() const { return (int)m_nodes.size(); }
+  int NodeOf(int a_worker) const { return m_workerNodes[a_worker]; }
+
+  // Whether a_worker's thread is pinned to its node; the calling thread never is
+  bool IsPinned(int a_worker) const { return m_pinned && a_worker < (int)m_threads.size(); }
+
+  // Calls a_func(job, worker) for every job in [0, a_jobs), handing jobs out
+  // dynamically.  worker is in [0, Size()).  Returns once all jobs are done.
+  // a_func is called in place, never copied, so launching allocates nothing.
+  template <typename F>
+  void ParallelFor(int a_jobs, F&& a_func)
+  {
+    Launch(a_jobs, &Invoke<typename std::remove_reference<F>::type>, (void*)&a_func, Mode::Dynamic);
+  }
+
+  // Same contract, but jobs are dealt out up front in contiguous blocks, one
+  // per worker.  Each worker takes jobs from the front of its own deque and,
+  // once that is empty, steals from the back of a randomly chosen victim's,
+  // trying workers on its own node on every other attempt.
+  template <typename F>
+  void ParallelForStealing(int a_jobs, F&& a_func)
+  {
+    Launch(a_jobs, &Invoke<typename std::remove_reference<F>::type>, (void*)&a_func, Mode::Stealing);
+  }
+
+  // Calls a_func(worker) once for every worker, each on that worker's own
+  // thread, e.g. to place memory on the node a worker is pinned to
+  template <typename F>
+  void ForEachWorker(F&& a_func)
+  {
+    auto call = [&](int, int a_worker) { a_func(a_worker); };
+    Launch(Size(), &Invoke<decltype(call)>, (void*)&call, Mode::EachWorker);
+  }
+
+private:
+  enum class Mode
+  {
+    Dynamic,     // Shared job counter
+    Stealing,    // Dealt blocks with work stealing
+    EachWorker   // Job i on worker i
+  };
+
+  typedef void (*JobFunc)(void* a_context, int a_job, int a_worker);
+
+  template <typename F>
+  static void Invoke(void* a_context, int a_job, int a_worker)
+  {
+    (*static_cast<F*>(a_context))(a_job, a_worker);
+  }
+
+  // A worker's block of jobs, [front, back).  The owner takes from the
+  // front and thieves from the back.
+  struct WorkQueue
+  {
+    std::mutex mutex;
+    int front = 0;
+    int back = 0;
+  };
+
+  void Launch(int a_jobs, JobFunc a_func, void* a_context, Mode a_mode);
+  void WorkerLoop(int a_worker);
+  void RunJobs(int a_worker);
+  void RunJobsStealing(int a_worker);
+
+  std::vector<NumaNode> m_nodes;   // One unless pinning to several nodes
+  std::vector<int> m_workerNodes;  // Index into m_nodes per worker
+  std::vector<std::vector<int>> m_nodeWorkers;
+  bool m_pinned = false;
+
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_done;
+
+  JobFunc m_func = nullptr;
+  void* m_context = nullptr;
+  int m_jobs = 0;
+  std::atomic<int> m_nextJob;
+  Mode m_mode = Mode::Dynamic;
+  std::vector<std::unique_ptr<WorkQueue>> m_queues;  // One per worker
+  std::atomic<int> m_remaining;
+  int m_busy = 0;
+  uint64_t m_generation = 0;
+  bool m_quit = false;
+};
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <cmath>
 #include <vector>
 #include <array>
 #include <random>
@@ -143,12 +144,12 @@ void main(void) {
   const char compShaderFmt[] = R"(#version 440
 const uint nNeurons = %i;
 const uint nLayers  = %i;
-const float freq[]  = {8.6, 7.5, 3.0, 9.8, 6.7, 5.3, 0.9, 8.6}; // Arbitrarily selected values
-const float phase[] = {3.1, 4.1, 5.9, 2.6, 5.3, 5.8, 9.8, 1.2};
-const float speed   = 0.05;
+const uint width    = %i;
+const uint height   = %i;
 layout(binding = 0) uniform writeonly image2D uDestTex;
-uniform float uTime;
+uniform float uFrameTerm[nNeurons];  // First layer's time inputs times their weights
 layout(binding = 0) buffer nn { float neuralNet[]; };
+layout(binding = 1) buffer fl { float firstLayer[]; };  // Per column, then per row: W * x, W * y
 layout (local_size_x = 16, local_size_y = 16) in;
 float scratchA[nNeurons];
 float scratchB[nNeurons];
@@ -176,16 +177,16 @@ void arr_sigmoid() {
 }
 
 void main() {
-  vec3 pos = vec3(gl_GlobalInvocationID) / (gl_NumWorkGroups * gl_WorkGroupSize);
+  // The first layer is linear in its inputs, and x only depends on the
+  // column, y on the row and the rest on the frame, so it comes down to
+  // adding three precomputed terms
+  uint column = gl_GlobalInvocationID.x * nNeurons;
+  uint row    = (width + gl_GlobalInvocationID.y) * nNeurons;
+  for (uint n = 0; n < nNeurons; n++)
+    scratchB[n] = firstLayer[column + n] + firstLayer[row + n] + uFrameTerm[n];
+  arr_tanh();
 
-  scratchA[0] = pos.x * 4.0 - 2.0;
-  scratchA[1] = pos.y * 4.0 - 2.0;
-  for (int i = 0; i < 8; i++)
-    scratchA[i+2] = sin(uTime*speed*freq[i]+phase[i]);
-  for (int i = 10; i < nNeurons; i++)
-    scratchA[i] = 0.0;
-
-  for (int i = 0; i < nLayers-1; i++) {
+  for (int i = 1; i < nLayers-1; i++) {
     multiply(i);
     arr_tanh();
   }
@@ -196,8 +197,8 @@ void main() {
   vec4 color = vec4(scratchA[0], scratchA[1], scratchA[2], 1.0);
   imageStore(uDestTex, ivec2(gl_GlobalInvocationID.xy), color);
 })";
-  char compShaderSrc[sizeof(compShaderFmt)+32];
-  sprintf_s(compShaderSrc, compShaderFmt, nNeurons, nLayers);
+  char compShaderSrc[sizeof(compShaderFmt)+64];
+  sprintf_s(compShaderSrc, compShaderFmt, nNeurons, nLayers, width, height);
   GLuint compShader  = CompileShader(compShaderSrc, GL_COMPUTE_SHADER);
   GLuint compProgram = LinkProgram({ compShader });
   glUseProgram(compProgram);
@@ -205,26 +206,57 @@ void main() {
   // Set up the neural net buffer
   GLuint neuralNetBuf;
   glGenBuffers(1, &neuralNetBuf);
+  const int totalSize = nNeurons * nNeurons * nLayers;
+  std::vector<float> neuralNet(totalSize);
   {
-    const int totalSize = nNeurons * nNeurons * nLayers;
     std::random_device rand;
     std::uniform_real_distribution<float> dist(-1, 1);
-    std::array<float, totalSize> temp;
     for (int i = 0; i < totalSize; i++)
-      temp[i] = dist(rand);
+      neuralNet[i] = dist(rand);
 
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, neuralNetBuf);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * totalSize, temp.data(), GL_STATIC_DRAW);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * totalSize, neuralNet.data(), GL_STATIC_DRAW);
   }
   glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, neuralNetBuf);
+
+  // First layer inputs are x and y in [-2, 2], then 8 sines of the time,
+  // then zeros.  The x and y terms only change with the column and row, so
+  // they are computed once here.
+  static const float freq[]  = { 8.6f, 7.5f, 3.0f, 9.8f, 6.7f, 5.3f, 0.9f, 8.6f }; // Arbitrarily selected values
+  static const float phase[] = { 3.1f, 4.1f, 5.9f, 2.6f, 5.3f, 5.8f, 9.8f, 1.2f };
+  static const float speed   = 0.05f;
+  GLuint firstLayerBuf;
+  glGenBuffers(1, &firstLayerBuf);
+  {
+    std::vector<float> terms((width + height) * nNeurons);
+    for (int x = 0; x < width; x++)
+      for (int n = 0; n < nNeurons; n++)
+        terms[x * nNeurons + n] = neuralNet[nNeurons * n + 0] * ((float)x / width * 4.0f - 2.0f);
+    for (int y = 0; y < height; y++)
+      for (int n = 0; n < nNeurons; n++)
+        terms[(width + y) * nNeurons + n] = neuralNet[nNeurons * n + 1] * ((float)y / height * 4.0f - 2.0f);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, firstLayerBuf);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * terms.size(), terms.data(), GL_STATIC_DRAW);
+  }
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, firstLayerBuf);
+  GLint uFrameTerm = glGetUniformLocation(compProgram, "uFrameTerm");
   error = glGetError();
 
   // Main loop
   while (!glfwWindowShouldClose(window))
   {
     // Generate the image in the compute shader
+    float time = (float)glfwGetTime();
+    float frameTerm[nNeurons];
+    for (int n = 0; n < nNeurons; n++)
+    {
+      frameTerm[n] = 0.0f;
+      for (int i = 0; i < 8; i++)
+        frameTerm[n] += neuralNet[nNeurons * n + i + 2] * std::sin(time * speed * freq[i] + phase[i]);
+    }
     glUseProgram(compProgram);
-    glUniform1f(glGetUniformLocation(compProgram, "uTime"), (float)glfwGetTime());
+    glUniform1fv(uFrameTerm, nNeurons, frameTerm);
     glDispatchCompute(width / 16, height / 16, 1);
     glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 